@@ -1,62 +1,556 @@
 #include "DslWriter.h"
 #include "ZipWriter.h"
 #include "dictlsd/UnicodePathFile.h"
+#include "dictlsd/OutputSink.h"
+#include "dictlsd/DictzipSink.h"
+#include "dictlsd/TaskScheduler.h"
 #include "dictlsd/tools.h"
 #include <boost/filesystem.hpp>
 #include <boost/format.hpp>
+#include <algorithm>
+#include <memory>
+#include <cstring>
+#include <mutex>
+#include <map>
+#include <unordered_map>
+#include <cwctype>
+#include <tuple>
+#include <zlib.h>
+
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
 
 using namespace dictlsd;
 namespace fs = boost::filesystem;
 
-void normalizeArticle(std::u16string& str) {
-    for (int i = str.length() - 1; i >= 0; --i) {
-        if (str[i] == u'\n') {
-            str.insert(i + 1, 1, u'\t');
+size_t findNewline(const char16_t* str, size_t pos, size_t length) {
+#ifdef __SSE2__
+    const __m128i newline = _mm_set1_epi16(u'\n');
+    for (; pos + 8 <= length; pos += 8) {
+        auto chars = _mm_loadu_si128(reinterpret_cast<const __m128i*>(str + pos));
+        int mask = _mm_movemask_epi8(_mm_cmpeq_epi16(chars, newline));
+        if (mask)
+            return pos + __builtin_ctz(mask) / 2;
+    }
+#endif
+    for (; pos < length; ++pos) {
+        if (str[pos] == u'\n')
+            return pos;
+    }
+    return length;
+}
+
+bool isHighSurrogate(char16_t ch) {
+    return ch >= 0xd800 && ch < 0xdc00;
+}
+
+TextSink::TextSink(std::unique_ptr<IOutputSink> sink, DslEncoding encoding)
+    : _sink(std::move(sink)), _utf8(encoding == DslEncoding::Utf8), _highSurrogate(0) { }
+
+size_t TextSink::bufferSize() const {
+    return _sink->bufferSize();
+}
+
+size_t TextSink::unitSize() const {
+    return _utf8 ? 4 : 2;
+}
+
+size_t TextSink::pieceEnd(const char16_t* str, size_t pos, size_t length, size_t maxLength) {
+    size_t end = std::min(length, pos + maxLength);
+    if (end < length && end - pos > 1 && isHighSurrogate(str[end - 1]))
+        --end;
+    return end;
+}
+
+char* TextSink::put(const char16_t* str, size_t length, char* out) {
+    if (_utf8) {
+        if (_highSurrogate && length) {
+            if (str[0] >= 0xdc00 && str[0] < 0xe000) {
+                char16_t pair[] = { _highSurrogate, str[0] };
+                out = utf16ToUtf8(pair, 2, out);
+                ++str;
+                --length;
+            }
+            _highSurrogate = 0;
+        }
+        if (length && isHighSurrogate(str[length - 1])) {
+            _highSurrogate = str[length - 1];
+            --length;
         }
+        return utf16ToUtf8(str, length, out);
     }
+    memcpy(out, str, 2 * length);
+    return out + 2 * length;
 }
 
+char* TextSink::reserve(size_t size) {
+    return _sink->reserve(size);
+}
+
+void TextSink::commit(size_t size) {
+    _sink->commit(size);
+}
+
+void TextSink::write(const char16_t* str, size_t length) {
+    size_t maxLength = bufferSize() / unitSize();
+    for (size_t piece = 0; piece < length;) {
+        size_t end = pieceEnd(str, piece, length, maxLength);
+        char* out = _sink->reserve(unitSize() * (end - piece));
+        _sink->commit(put(str + piece, end - piece, out) - out);
+        piece = end;
+    }
+}
+
+void TextSink::close() {
+    _sink->close();
+}
+
+void writeArticle(TextSink& sink, const char16_t* str, size_t length) {
+    // each character takes at most 4 bytes once expanded
+    size_t pieceLength = sink.bufferSize() / 4;
+    for (size_t piece = 0; piece < length;) {
+        size_t pieceEnd = TextSink::pieceEnd(str, piece, length, pieceLength);
+        char* out = sink.reserve(4 * (pieceEnd - piece));
+        char* start = out;
+        for (size_t pos = piece; pos < pieceEnd;) {
+            size_t newline = findNewline(str, pos, pieceEnd);
+            size_t run = newline == pieceEnd ? pieceEnd - pos : newline - pos + 1;
+            out = sink.put(str + pos, run, out);
+            pos += run;
+            if (newline != pieceEnd) {
+                out = sink.put(u"\t", 1, out);
+            }
+        }
+        sink.commit(out - start);
+        piece = pieceEnd;
+    }
+}
+
+// A rough number of characters the decoded articles and heading lines add up
+// to, for preallocating the output. Articles come to about two characters
+// per stored byte, a heading line to a couple dozen.
+uint64_t estimateDslLength(const LSDDictionary* reader, size_t headingCount) {
+    return 2 * uint64_t(reader->articlesSize()) + 24 * uint64_t(headingCount);
+}
+
+// Decodes every article once, in ascending reference order, into a spill file
+// and then serves the raw articles by reference.
+class ArticleSpill {
+    fs::path _path;
+    std::vector<unsigned> _references;
+    std::vector<std::pair<uint64_t, unsigned>> _ranges;
+    std::unique_ptr<UnicodePathFile> _file;
+    std::vector<char> _buf;
+public:
+    ArticleSpill(const LSDDictionary* reader,
+                 std::vector<ArticleHeading> const& headings,
+                 fs::path path)
+        : _path(path)
+    {
+        for (auto& heading : headings) {
+            _references.push_back(heading.articleReference());
+        }
+        std::sort(begin(_references), end(_references));
+        _references.erase(std::unique(begin(_references), end(_references)), end(_references));
+        _ranges.reserve(_references.size());
+        {
+            // one forward sweep, each article is spilled as soon as it's decoded
+            OutputSink spill(_path.string());
+            spill.preallocate(2 * estimateDslLength(reader, 0));
+            uint64_t offset = 0;
+            reader->foreachArticle(_references, [&](unsigned, std::u16string const& article) {
+                unsigned size = 2 * article.length();
+                spill.write(article);
+                _ranges.push_back({offset, size});
+                offset += size;
+            });
+            spill.close();
+        }
+        _file.reset(new UnicodePathFile(_path.string(), false));
+    }
+
+    std::vector<char> const& article(unsigned reference) {
+        auto it = std::lower_bound(begin(_references), end(_references), reference);
+        auto range = _ranges.at(std::distance(begin(_references), it));
+        _buf.resize(range.second);
+        if (_file->readAt(range.first, _buf.data(), range.second) != range.second)
+            throw std::runtime_error("can't read spilled article");
+        return _buf;
+    }
+
+    ~ArticleSpill() {
+        _file.reset();
+        boost::system::error_code ec;
+        fs::remove(_path, ec);
+    }
+};
+
+ArticlePrefetcher::ArticlePrefetcher(const LSDDictionary* reader,
+                                     std::vector<ArticleHeading>& headings,
+                                     bool dumb,
+                                     size_t window)
+    : _reader(reader), _window(window)
+{
+    foreachReferenceSet(headings, [&](auto first, auto) {
+        _order.push_back(first->articleReference());
+    }, dumb);
+    _sorted = _order;
+    std::sort(begin(_sorted), end(_sorted));
+    _sorted.erase(std::unique(begin(_sorted), end(_sorted)), end(_sorted));
+}
+
+void ArticlePrefetcher::advance(size_t current) {
+    // articles are stored back to back, so an article ends where the next
+    // larger reference begins
+    for (; _next < _order.size() && _next < current + _window; ++_next) {
+        unsigned reference = _order[_next];
+        auto it = std::upper_bound(begin(_sorted), end(_sorted), reference);
+        unsigned end = it == _sorted.end() ? _reader->articlesSize() : *it;
+        if (end > reference) {
+            _reader->prefetchArticle(reference, end - reference);
+        }
+    }
+}
+
+// Runs produce(i) for every i below count as tasks of the scheduler and
+// consume(i, result) on the calling thread in ascending order of i. The items
+// are produced in batches, at most one batch ahead of the consumer, which
+// bounds the results held at once. Unless parallel everything runs on the
+// calling thread.
+template <typename T, typename Produce, typename Consume>
+void orderedParallel(size_t count, bool parallel, Produce produce, Consume consume) {
+    if (!parallel) {
+        for (size_t i = 0; i < count; ++i) {
+            T value = produce(i);
+            consume(i, value);
+        }
+        return;
+    }
+    struct Batch {
+        size_t first = 0;
+        std::vector<std::unique_ptr<T>> values;
+    };
+    const size_t batchSize = 2 * TaskScheduler::global().threads();
+    TaskBatches<Batch> batches;
+    auto consumeBatch = [&](Batch& batch) {
+        for (size_t j = 0; j < batch.values.size(); ++j) {
+            consume(batch.first + j, *batch.values[j]);
+        }
+        batch.values.clear();
+    };
+    for (size_t first = 0; first < count; first += batchSize) {
+        auto& batch = batches.current();
+        batch.first = first;
+        batch.values.resize(std::min(batchSize, count - first));
+        for (size_t j = 0; j < batch.values.size(); ++j) {
+            batches.run([&, j] {
+                batch.values[j].reset(new T(produce(batch.first + j)));
+            });
+        }
+        batches.next(consumeBatch);
+    }
+    batches.wait(consumeBatch);
+}
+
+fs::path overlayFilePath(std::u16string const& name) {
+    fs::path path(toUtf8(name));
+    if (path.empty() || path.has_root_path())
+        throw std::runtime_error("bad overlay entry name: " + path.string());
+    for (auto& part : path) {
+        if (part == "..")
+            throw std::runtime_error("bad overlay entry name: " + path.string());
+    }
+    return path;
+}
+
+// A path with its letters in one case, equal for paths that name the same
+// file on a case-insensitive file system.
+std::u16string foldPathCase(fs::path const& path) {
+    auto folded = toUtf16(path.generic_string());
+    for (auto& ch : folded) {
+        ch = std::towlower(ch);
+    }
+    return folded;
+}
+
+// Finds overlay entries that repeat earlier ones while the overlay is being
+// extracted, reading every stored stream once. Only entries whose stream and
+// inflated sizes match another entry's are candidates; their streams are
+// keyed by CRC-32 as they come in, and a stream whose key was seen before is
+// compared with the cached stream of the first entry with that key. A cached
+// stream is dropped once no candidate of its sizes is left.
+class OverlayDuplicates {
+    typedef std::pair<uint32_t, uint32_t> Sizes;
+    std::vector<OverlayHeading> const& _headings;
+    std::map<Sizes, size_t> _left;
+    std::vector<bool> _candidates;
+    std::vector<bool> _leads;
+    std::map<std::tuple<Sizes, uint32_t>, std::pair<size_t, std::vector<uint8_t>>> _firsts;
+
+    static Sizes sizes(OverlayHeading const& heading) {
+        return {heading.streamSize, heading.inflatedSize};
+    }
+
+public:
+    OverlayDuplicates(std::vector<OverlayHeading> const& headings)
+        : _headings(headings), _candidates(headings.size()), _leads(headings.size())
+    {
+        for (size_t i = 0; i < headings.size(); ++i) {
+            _leads[i] = _left[sizes(headings[i])]++ == 0;
+        }
+        for (size_t i = 0; i < headings.size(); ++i) {
+            _candidates[i] = _left[sizes(headings[i])] > 1;
+        }
+    }
+
+    // can be called from any thread, as can extractEarly
+    bool candidate(size_t i) const {
+        return _candidates[i];
+    }
+
+    // Whether candidate i is worth extracting before it is known to be an
+    // original: all but the first of the candidates with the same sizes are
+    // likely repeats.
+    bool extractEarly(size_t i) const {
+        return _leads[i];
+    }
+
+    static uint32_t crc(std::vector<uint8_t> const& stream) {
+        return static_cast<uint32_t>(crc32(crc32(0, nullptr, 0), stream.data(), stream.size()));
+    }
+
+    // Called in ascending order of i for candidates with the stored stream
+    // and its CRC-32. Returns the entry i repeats or i itself.
+    size_t original(size_t i, std::vector<uint8_t> const& stream, uint32_t streamCrc) {
+        auto entrySizes = sizes(_headings[i]);
+        auto& left = _left.at(entrySizes);
+        size_t res = i;
+        auto it = _firsts.find(std::make_tuple(entrySizes, streamCrc));
+        if (it == end(_firsts)) {
+            _firsts.emplace(std::make_tuple(entrySizes, streamCrc), std::make_pair(i, stream));
+        } else if (it->second.second == stream) {
+            res = it->second.first;
+        }
+        if (--left == 0) {
+            _firsts.erase(_firsts.lower_bound(std::make_tuple(entrySizes, 0u)),
+                          _firsts.upper_bound(std::make_tuple(entrySizes, ~0u)));
+        }
+        return res;
+    }
+};
+
+// Extracts the overlay, reading entries on several threads when the reader
+// allows concurrent use. A zip gets the deflated entries appended by a single
+// writer in heading order, a directory gets a file per entry. Every stored
+// stream is read once. An entry that repeats an earlier one is neither
+// inflated nor deflated again: it becomes a hard link to the original file,
+// or goes into the zip with the CRC of the original. The zip still holds its
+// compressed data, as a zip entry can't share data with another one. Such
+// aliases are listed in aliasesPath.
+void writeOverlay(const LSDDictionary* reader,
+                  std::vector<OverlayHeading> const& headings,
+                  fs::path path,
+                  fs::path aliasesPath,
+                  bool directory)
+{
+    bool parallel = reader->concurrent();
+    OverlayDuplicates duplicates(headings);
+    struct Extracted {
+        std::vector<uint8_t> stream;
+        uint32_t streamCrc;
+        bool done;
+        DeflatedOverlayEntry entry;
+    };
+    // reads the stream of entry i, extracting it right away if early and it
+    // isn't likely to repeat an earlier entry; otherwise consume decides
+    auto read = [&](size_t i, bool early, std::function<void(Extracted&)> extract) {
+        Extracted extracted{reader->readOverlayStream(headings[i]), 0, false, {}};
+        if (duplicates.candidate(i)) {
+            extracted.streamCrc = OverlayDuplicates::crc(extracted.stream);
+        }
+        if (early && (!duplicates.candidate(i) || duplicates.extractEarly(i))) {
+            extract(extracted);
+            extracted.done = true;
+        }
+        return extracted;
+    };
+    std::string aliases;
+    auto addAlias = [&](size_t i, size_t original) {
+        aliases += toUtf8(headings[i].name) + "\t" + toUtf8(headings[original].name) + "\n";
+    };
+
+    if (directory) {
+        // Entries that map to the same file, through a repeated name or names
+        // that differ in case on a case-insensitive file system, are
+        // extracted by consume in heading order, so that the last one wins.
+        // They are never hard linked, as a later entry would overwrite the
+        // linked file too.
+        std::vector<fs::path> paths;
+        std::vector<bool> colliding(headings.size());
+        std::unordered_map<std::u16string, size_t> firstPaths;
+        for (size_t i = 0; i < headings.size(); ++i) {
+            paths.push_back(path / overlayFilePath(headings[i].name));
+            fs::create_directories(paths.back().parent_path());
+            auto first = firstPaths.emplace(foldPathCase(paths.back()), i);
+            if (!first.second) {
+                colliding[i] = colliding[first.first->second] = true;
+            }
+        }
+        auto inflate = [&](size_t i, std::vector<uint8_t> const& stream) {
+            UnicodePathFile file(paths[i].string(), true);
+            reader->inflateOverlayStream(headings[i], stream, [&](const uint8_t* data, size_t size) {
+                file.write(reinterpret_cast<const char*>(data), size);
+            });
+        };
+        orderedParallel<Extracted>(headings.size(), parallel, [&](size_t i) {
+            return read(i, !colliding[i], [&](Extracted& extracted) { inflate(i, extracted.stream); });
+        }, [&](size_t i, Extracted& extracted) {
+            size_t original = duplicates.candidate(i)
+                ? duplicates.original(i, extracted.stream, extracted.streamCrc)
+                : i;
+            if (original == i) {
+                if (!extracted.done) {
+                    inflate(i, extracted.stream);
+                }
+                return;
+            }
+            if (colliding[i] || colliding[original]) {
+                inflate(i, extracted.stream);
+                if (paths[i] != paths[original]) {
+                    addAlias(i, original);
+                }
+                return;
+            }
+            fs::remove(paths[i]);
+            boost::system::error_code ec;
+            fs::create_hard_link(paths[original], paths[i], ec);
+            if (ec) {
+                fs::copy_file(paths[original], paths[i]);
+            }
+            addAlias(i, original);
+        });
+    } else {
+        // the CRC-32 and the deflate data size of every original written
+        std::vector<std::pair<uint32_t, size_t>> written(headings.size());
+        ZipWriter zip(path.string());
+        std::string name;
+        orderedParallel<Extracted>(headings.size(), parallel, [&](size_t i) {
+            return read(i, true, [&](Extracted& extracted) {
+                // a candidate's stream is still needed for the comparison
+                if (duplicates.candidate(i)) {
+                    extracted.entry = reader->deflatedOverlayEntry(headings[i], extracted.stream);
+                } else {
+                    extracted.entry = reader->deflatedOverlayEntry(headings[i], std::move(extracted.stream));
+                }
+            });
+        }, [&](size_t i, Extracted& extracted) {
+            size_t original = duplicates.candidate(i)
+                ? duplicates.original(i, extracted.stream, extracted.streamCrc)
+                : i;
+            toUtf8(headings[i].name, name);
+            if (original != i) {
+                // the same zlib stream, so the deflate data sits right after
+                // the two byte header and has the original's size
+                auto& first = written[original];
+                zip.addDeflatedFile(name, extracted.stream.data() + 2, first.second, first.first, headings[i].inflatedSize);
+                addAlias(i, original);
+                return;
+            }
+            if (!extracted.done) {
+                extracted.entry = reader->deflatedOverlayEntry(headings[i], std::move(extracted.stream));
+            }
+            auto& entry = extracted.entry;
+            zip.addDeflatedFile(name, entry.data.data(), entry.data.size(), entry.crc32, entry.inflatedSize);
+            written[i] = {entry.crc32, entry.data.size()};
+        });
+    }
+
+    if (!aliases.empty()) {
+        UnicodePathFile file(aliasesPath.string(), true);
+        file.write(aliases.data(), aliases.size());
+    }
+}
+
+// Combines the progress of conversion phases running side by side into one
+// percentage. Each track reports how far it has got through its own work.
+class ProgressLog {
+    std::function<void(int,std::string)> _log;
+    std::mutex _mutex;
+    std::vector<int> _tracks;
+public:
+    ProgressLog(std::function<void(int,std::string)> log, unsigned tracks)
+        : _log(log), _tracks(tracks) { }
+
+    void operator()(unsigned track, int percent, std::string message) {
+        std::lock_guard<std::mutex> lock(_mutex);
+        _tracks[track] = percent;
+        int total = 0;
+        for (int trackPercent : _tracks) {
+            total += trackPercent;
+        }
+        _log(total / _tracks.size(), message);
+    }
+
+    // records that a track is complete without logging anything
+    void done(unsigned track) {
+        std::lock_guard<std::mutex> lock(_mutex);
+        _tracks[track] = 100;
+    }
+};
+
 void writeDSL(const LSDDictionary* reader,
               std::string lsdName,
               std::string outputPath,
-              bool dumb,
+              DslWriterOptions const& options,
               std::function<void(int,std::string)> log)
 {
+    bool dumb = options.dumb;
     fs::path dslPath = outputPath / fs::path(lsdName).replace_extension("dsl");
     fs::path annoPath = dslPath;
     fs::path iconPath = dslPath;
-    fs::path overlayPath = fs::path(dslPath).string() + ".files.zip";
+    fs::path overlayPath = fs::path(dslPath).string() + (options.overlayDirectory ? ".files" : ".files.zip");
     annoPath.replace_extension("ann");
     iconPath.replace_extension("bmp");
+    auto& iconArr = reader->icon();
 
-    auto overlayHeadings = reader->readOverlayHeadings();
-    if (overlayHeadings.size() > 0) {
-        log(5, str(boost::format("decoding overlay (%1% entries): %2%") % overlayHeadings.size() % overlayPath.string()));
-        ZipWriter zip(overlayPath.string());
-        for (OverlayHeading heading : overlayHeadings) {
-            std::vector<uint8_t> entry = reader->readOverlayEntry(heading);
-            zip.addFile(toUtf8(heading.name), entry.data(), entry.size());
+    // The overlay, annotation and icon don't depend on anything else. With a
+    // concurrent reader they are written by a task of the scheduler while
+    // this thread decodes the headings and writes the dsl.
+    ProgressLog progress(log, 2);
+    const unsigned sideTrack = 0, mainTrack = 1;
+    auto writeSideOutputs = [&] {
+        auto overlayHeadings = reader->readOverlayHeadings();
+        if (overlayHeadings.size() > 0) {
+            progress(sideTrack, 0, str(boost::format("decoding overlay (%1% entries): %2%") % overlayHeadings.size() % overlayPath.string()));
+            writeOverlay(reader, overlayHeadings, overlayPath, dslPath.string() + ".files.aliases", options.overlayDirectory);
         }
-    }
-
-    const char16_t* bom = u"\ufeff";
 
-    std::u16string annoStr = reader->annotation();
-    if (!annoStr.empty()) {
-        log(25, "writing annotation: " + annoPath.string());
-        UnicodePathFile anno(annoPath.string(), true);
-        anno.write((char*)bom, 2);
-        anno.write((char*)annoStr.c_str(), 2 * annoStr.length());
-    }
+        std::u16string annoStr = reader->annotation();
+        if (!annoStr.empty()) {
+            progress(sideTrack, 80, "writing annotation: " + annoPath.string());
+            TextSink anno(std::unique_ptr<IOutputSink>(new OutputSink(annoPath.string(), 1 << 16)),
+                          options.encoding);
+            anno.write(u"\ufeff");
+            anno.write(annoStr);
+            anno.close();
+        }
 
-    auto iconArr = reader->icon();
-    if (!iconArr.empty()) {
-        log(35, "writing icon: " + iconPath.string());
-        UnicodePathFile icon(iconPath.string(), true);
-        icon.write(reinterpret_cast<const char*>(&iconArr[0]), iconArr.size());
+        if (!iconArr.empty()) {
+            progress(sideTrack, 90, "writing icon: " + iconPath.string());
+            UnicodePathFile icon(iconPath.string(), true);
+            icon.write(reinterpret_cast<const char*>(&iconArr[0]), iconArr.size());
+        }
+        progress.done(sideTrack);
+    };
+    TaskGroup sideOutputs;
+    if (reader->concurrent()) {
+        sideOutputs.run(writeSideOutputs);
+    } else {
+        writeSideOutputs();
     }
 
-    log(45, "decoding dictionary");
+    progress(mainTrack, 0, "decoding dictionary");
 
     auto headings = reader->readHeadings();
     if (headings.size() != reader->header().entriesCount) {
@@ -64,36 +558,66 @@ void writeDSL(const LSDDictionary* reader,
     }
 
     if (!dumb) {
-        log(60, "collapsing variant headings");
+        progress(mainTrack, 30, "collapsing variant headings");
         collapseVariants(headings);
     }
 
-    log(80, "writing dsl: " + dslPath.string());
-
-    UnicodePathFile dsl(dslPath.string(), true);
-    dsl.write((char*)bom, 2);
-
-    auto dslwrite = [&](std::u16string const& line) {
-        dsl.write((char*)line.c_str(), 2 * line.length());
-    };
+    std::unique_ptr<ArticleSpill> spill;
+    if (options.offsetOrder) {
+        progress(mainTrack, 40, "decoding articles in file order");
+        spill.reset(new ArticleSpill(reader, headings, dslPath.string() + ".articles"));
+    }
 
-    dslwrite(u"#NAME\t\"" + reader->name() + u"\"\r\n");
-    dslwrite(u"#INDEX_LANGUAGE\t\"" + langFromCode(reader->header().sourceLanguage) + u"\"\n");
-    dslwrite(u"#CONTENTS_LANGUAGE\t\"" + langFromCode(reader->header().targetLanguage) + u"\"\n");
+    std::unique_ptr<IOutputSink> sink;
+    if (options.dictzip) {
+        auto dzPath = dslPath.string() + ".dz";
+        progress(mainTrack, 60, "writing dsl: " + dzPath);
+        sink.reset(new DictzipSink(dzPath));
+    } else {
+        progress(mainTrack, 60, "writing dsl: " + dslPath.string());
+        std::unique_ptr<OutputSink> file(new OutputSink(dslPath.string()));
+        uint64_t length = estimateDslLength(reader, headings.size());
+        file->preallocate(options.encoding == DslEncoding::Utf8 ? length + length / 2 : 2 * length);
+        sink = std::move(file);
+    }
+    TextSink dsl(std::move(sink), options.encoding);
+    dsl.write(u"\ufeff");
+    dsl.write(u"#NAME\t\"");
+    dsl.write(reader->name());
+    dsl.write(u"\"\r\n#INDEX_LANGUAGE\t\"");
+    dsl.write(langFromCode(reader->header().sourceLanguage));
+    dsl.write(u"\"\n#CONTENTS_LANGUAGE\t\"");
+    dsl.write(langFromCode(reader->header().targetLanguage));
+    dsl.write(u"\"\n");
     if (!iconArr.empty()) {
-        dslwrite(u"#ICON_FILE\t\"" + toUtf16(iconPath.filename().string()) + u"\"\n");
+        dsl.write(u"#ICON_FILE\t\"");
+        dsl.write(toUtf16(iconPath.filename().string()));
+        dsl.write(u"\"\n");
+    }
+    dsl.write(u"\n");
+    std::unique_ptr<ArticlePrefetcher> prefetcher;
+    if (!spill) {
+        prefetcher.reset(new ArticlePrefetcher(reader, headings, dumb));
     }
-    dslwrite(u"\n");
+    size_t referenceSet = 0;
     foreachReferenceSet(headings, [&](auto first, auto last) {
+        if (prefetcher) {
+            prefetcher->advance(referenceSet++);
+        }
         for (auto it = first; it != last; ++it) {
-            const std::u16string& headingText = it->dslText();
-            dslwrite(headingText.c_str());
-            dslwrite(u"\n");
-        }
-        dslwrite(u"\t");
-        std::u16string article = reader->readArticle(first->articleReference());
-        normalizeArticle(article);
-        dslwrite(article.c_str());
-        dslwrite(u"\n");
+            dsl.write(it->dslText());
+            dsl.write(u"\n");
+        }
+        dsl.write(u"\t");
+        if (spill) {
+            auto& article = spill->article(first->articleReference());
+            writeArticle(dsl, reinterpret_cast<const char16_t*>(article.data()), article.size() / 2);
+        } else {
+            std::u16string article = reader->readArticle(first->articleReference());
+            writeArticle(dsl, article.data(), article.length());
+        }
+        dsl.write(u"\n");
     }, dumb);
+    dsl.close();
+    sideOutputs.wait();
 }
@@ -1,11 +1,96 @@
 #pragma once
 
 #include "dictlsd/lsd.h"
+#include "dictlsd/OutputSink.h"
+#include <boost/filesystem/path.hpp>
 #include <string>
+#include <memory>
 #include <functional>
 
+enum class DslEncoding { Utf16, Utf8 };
+
+struct DslWriterOptions {
+    // don't combine variant headings and headings referencing the same article
+    bool dumb = false;
+    // decode the articles in file order into a spill file first, then copy
+    // them into the dsl in heading order
+    bool offsetOrder = false;
+    // encoding of the dsl and the annotation, both start with a BOM
+    DslEncoding encoding = DslEncoding::Utf16;
+    // write a dictzip compressed .dsl.dz instead of the plain dsl
+    bool dictzip = false;
+    // extract the overlay into a .files directory instead of a .files.zip
+    bool overlayDirectory = false;
+};
+
 void writeDSL(const dictlsd::LSDDictionary* reader,
               std::string lsdName,
               std::string outputPath,
-              bool dumb,
+              DslWriterOptions const& options,
               std::function<void(int,std::string)> log);
+
+// the path of an overlay entry inside the extraction directory, throws if the
+// name is absolute or leads out of it
+boost::filesystem::path overlayFilePath(std::u16string const& name);
+
+// extracts the overlay into a zip or a directory, listing entries that
+// repeat earlier ones in aliasesPath
+void writeOverlay(const dictlsd::LSDDictionary* reader,
+                  std::vector<dictlsd::OverlayHeading> const& headings,
+                  boost::filesystem::path path,
+                  boost::filesystem::path aliasesPath,
+                  bool directory);
+
+// Keeps the byte ranges of the next few reference sets hinted to the stream
+// while the writer works through them, the sets in the order the writer
+// visits them.
+class ArticlePrefetcher {
+    const dictlsd::LSDDictionary* _reader;
+    std::vector<unsigned> _order;
+    std::vector<unsigned> _sorted;
+    size_t _window;
+    size_t _next = 0;
+public:
+    ArticlePrefetcher(const dictlsd::LSDDictionary* reader,
+                      std::vector<dictlsd::ArticleHeading>& headings,
+                      bool dumb,
+                      size_t window = 64);
+    // hints every set before current + window that isn't hinted yet
+    void advance(size_t current);
+};
+
+// Text output in the chosen encoding. UTF-8 is transcoded from UTF-16
+// straight into the sink's buffer, without an intermediate string.
+class TextSink {
+    std::unique_ptr<dictlsd::IOutputSink> _sink;
+    bool _utf8;
+    // a high surrogate that ended the last write, held back until the low
+    // surrogate arrives; UTF-8 can only encode the pair as a whole
+    char16_t _highSurrogate;
+public:
+    TextSink(std::unique_ptr<dictlsd::IOutputSink> sink, DslEncoding encoding);
+    size_t bufferSize() const;
+    // the most bytes an encoded UTF-16 unit takes, counting a surrogate pair
+    // completed with a high surrogate from the previous write
+    size_t unitSize() const;
+    // a piece of at most maxLength units starting at pos that doesn't split
+    // a surrogate pair
+    static size_t pieceEnd(const char16_t* str, size_t pos, size_t length, size_t maxLength);
+    // out must have room for unitSize() bytes per unit
+    char* put(const char16_t* str, size_t length, char* out);
+    char* reserve(size_t size);
+    void commit(size_t size);
+    void write(const char16_t* str, size_t length);
+    void write(std::u16string const& str) {
+        write(str.data(), str.length());
+    }
+    template <size_t N> void write(const char16_t (&literal)[N]) {
+        write(literal, N - 1);
+    }
+    void close();
+};
+
+// Writes an article body, indenting every line after a newline with a tab
+// as DSL requires. The text between newlines is encoded in bulk straight
+// into the sink's buffer.
+void writeArticle(TextSink& sink, const char16_t* str, size_t length);
@@ -11,7 +11,7 @@ ZipWriter::ZipWriter(std::string path) {
         throw std::runtime_error("can't create zip file");
 }
 
-void ZipWriter::addFile(std::string name, const void* ptr, unsigned size) {
+void ZipWriter::openFile(std::string const& name, bool raw) {
     auto t = time(nullptr);
     auto tm = *localtime(&t);
     zip_fileinfo info{{(unsigned)tm.tm_sec,
@@ -23,7 +23,7 @@ void ZipWriter::addFile(std::string name, const void* ptr, unsigned size) {
                       0,
                       0,
                       0};
-    auto ret = zipOpenNewFileInZip64(_zip,
+    auto ret = zipOpenNewFileInZip2_64(_zip,
                           name.c_str(),
                           &info,
                           nullptr,
@@ -33,13 +33,35 @@ void ZipWriter::addFile(std::string name, const void* ptr, unsigned size) {
                           nullptr,
                           Z_DEFLATED,
                           Z_DEFAULT_COMPRESSION,
+                          raw,
                           1);
     if (ret)
         throw std::runtime_error("can't add a new file to zip");
-    ret = zipWriteInFileInZip(_zip, ptr, size);
+}
+
+void ZipWriter::write(const void* ptr, unsigned size) {
+    auto ret = zipWriteInFileInZip(_zip, ptr, size);
     if (ret)
         throw std::runtime_error("can't write to zip");
-    ret = zipCloseFileInZip(_zip);
+}
+
+void ZipWriter::addFile(std::string name, const void* ptr, unsigned size) {
+    openFile(name, false);
+    write(ptr, size);
+    auto ret = zipCloseFileInZip(_zip);
+    if (ret)
+        throw std::runtime_error("can't save zip");
+}
+
+void ZipWriter::addDeflatedFile(std::string name,
+                                const void* ptr,
+                                unsigned size,
+                                uint32_t crc32,
+                                uint64_t inflatedSize)
+{
+    openFile(name, true);
+    write(ptr, size);
+    auto ret = zipCloseFileInZipRaw64(_zip, inflatedSize, crc32);
     if (ret)
         throw std::runtime_error("can't save zip");
 }
@@ -2,12 +2,21 @@
 
 #include <string>
 #include <vector>
+#include <stdint.h>
 
 class ZipWriter {
     void* _zip;
+    void openFile(std::string const& name, bool raw);
+    void write(const void* ptr, unsigned size);
 
 public:
     ZipWriter(std::string path);
     void addFile(std::string name, const void* ptr, unsigned size);
+    // stores an already deflated file as is
+    void addDeflatedFile(std::string name,
+                         const void* ptr,
+                         unsigned size,
+                         uint32_t crc32,
+                         uint64_t inflatedSize);
     ~ZipWriter();
 };
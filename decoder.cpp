@@ -4,16 +4,21 @@
 #include "dictlsd/lsd.h"
 #include "dictlsd/tools.h"
 #include "dictlsd/LSAReader.h"
+#include "dictlsd/ArchiveStream.h"
+#include "dictlsd/TaskScheduler.h"
 
 #include <boost/program_options.hpp>
 #include <boost/filesystem.hpp>
 #include <boost/format.hpp>
 
 #include <iostream>
+#include <sstream>
+#include <mutex>
 #include <string>
 #include <vector>
 #include <tuple>
 #include <map>
+#include <stdexcept>
 
 namespace fs = boost::filesystem;
 namespace po = boost::program_options;
@@ -34,12 +39,15 @@ int parseLSD(fs::path lsdPath,
              fs::path outputPath,
              int sourceFilter,
              int targetFilter,
-             bool dumb,
-             std::ostream& log)
+             DslWriterOptions const& options,
+             bool listHeadings,
+             std::ostream& log,
+             std::mutex& listMutex)
 {
-    FileStream ras(lsdPath.string());
+    auto file = openDictionaryStream(lsdPath.string());
+    PrefetchStream ras(file.get());
     BitStreamAdapter bstr(&ras);
-    LSDDictionary reader(&bstr);
+    LSDDictionary reader(&bstr, true);
     LSDHeader header = reader.header();
     log << "Header:";
     log << "\n  Version:  " << std::hex << header.version << std::dec;
@@ -68,24 +76,43 @@ int parseLSD(fs::path lsdPath,
         return 0;
     }
 
+    if (listHeadings) {
+        // streamed straight to stdout, one listing at a time
+        std::lock_guard<std::mutex> lock(listMutex);
+        std::string utf8;
+        reader.foreachPlainHeading([&](std::u16string const& heading, unsigned reference) {
+            toUtf8(heading, utf8);
+            std::cout << utf8 << '\t' << reference << '\n';
+        });
+        std::cout.flush();
+        return 0;
+    }
+
     if (!outputPath.empty()) {
-        writeDSL(&reader, lsdPath.filename().string(), outputPath.string(),
-                 dumb, [&](int, std::string s) { log << s << std::endl; });
+        writeDSL(&reader, dictionaryFileName(lsdPath.string()), outputPath.string(),
+                 options, [&](int, std::string s) { log << s << std::endl; });
     }
 
     return 0;
 }
 
 int main(int argc, char* argv[]) {
-    std::string lsdPath, lsaPath, outputPath;
+    std::vector<std::string> lsdPaths, lsaPaths;
+    std::string outputPath, encoding;
+    unsigned threads = 0;
     int sourceFilter = -1, targetFilter = -1;
-    bool isDumb;
+    DslWriterOptions options;
+    bool listHeadings;
     po::options_description console_desc("Allowed options");
     try {
         console_desc.add_options()
             ("help", "produce help message")
-            ("lsd", po::value<std::string>(&lsdPath), "LSD dictionary to decode")
-            ("lsa", po::value<std::string>(&lsaPath), "LSA sound archive to decode")
+            ("lsd", po::value<std::vector<std::string>>(&lsdPaths)->multitoken(),
+                "LSD dictionaries to decode, each either a file, a .gz file or "
+                "archive.zip/entry.lsd")
+            ("lsa", po::value<std::vector<std::string>>(&lsaPaths)->multitoken(),
+                "LSA sound archives to decode, each either a file, a .gz file or "
+                "archive.zip/entry.lsa")
             ("source-filter", po::value<int>(&sourceFilter),
                 "ignore dictionaries with source language != source-filter")
             ("target-filter", po::value<int>(&targetFilter),
@@ -94,6 +121,19 @@ int main(int argc, char* argv[]) {
             ("out", po::value<std::string>(&outputPath), "output directory")
             ("dumb", "don't combine variant headings and headings "
                      "referencing the same article")
+            ("offset-order", "decode the articles in file order through a spill "
+                             "file, then write them in heading order")
+            ("encoding", po::value<std::string>(&encoding)->default_value("utf16"),
+                "encoding of the dsl and annotation files, utf16 or utf8")
+            ("dictzip", "compress the dsl into a .dsl.dz dictzip file")
+            ("overlay-dir", "extract embedded pictures and sounds into a directory "
+                            "instead of a zip file")
+            ("list-headings", "print the sorted headings and their article "
+                              "references instead of decoding articles, "
+                              "can't be combined with --out")
+            ("threads", po::value<unsigned>(&threads),
+                "number of threads shared by all the inputs, the number of cores "
+                "by default")
             ("version", "print version")
             ;
         po::variables_map console_vm;
@@ -110,8 +150,21 @@ int main(int argc, char* argv[]) {
             std::cout << "lsd2dsl version " << g_version << std::endl;
             return 0;
         }
-        isDumb = console_vm.count("dumb");
+        options.dumb = console_vm.count("dumb");
+        options.offsetOrder = console_vm.count("offset-order");
+        options.dictzip = console_vm.count("dictzip");
+        options.overlayDirectory = console_vm.count("overlay-dir");
+        listHeadings = console_vm.count("list-headings");
+        if (listHeadings && console_vm.count("out")) {
+            throw std::runtime_error("--list-headings and --out can't be used together");
+        }
         po::notify(console_vm);
+        if (encoding == "utf8") {
+            options.encoding = DslEncoding::Utf8;
+        } else if (encoding != "utf16") {
+            throw std::runtime_error("unknown encoding " + encoding);
+        }
+        TaskScheduler::setGlobalThreads(threads);
     } catch(std::exception& e) {
         std::cout << "can't parse program options:\n";
         std::cout << e.what() << "\n\n";
@@ -119,7 +172,7 @@ int main(int argc, char* argv[]) {
         return 1;
     }
 
-    if (lsdPath.empty() && lsaPath.empty()) {
+    if (lsdPaths.empty() && lsaPaths.empty()) {
         std::cout << console_desc;
         return 0;
     }
@@ -129,21 +182,58 @@ int main(int argc, char* argv[]) {
             fs::create_directories(outputPath);
             outputPath = fs::canonical(outputPath).string();
         }
-        if (!lsdPath.empty()) {
-            parseLSD(lsdPath,
-                     outputPath,
-                     sourceFilter,
-                     targetFilter,
-                     isDumb,
-                     std::cout);
-        }
-        if (!lsaPath.empty()) {
-            decodeLSA(lsaPath, outputPath, [](int i) { std::cout << i << std::endl; });
-        }
     } catch (std::exception& exc) {
         std::cout << "an error occured while processing dictionary: " << exc.what() << std::endl;
         return 1;
     }
 
-    return 0;
+    // Every input is converted by a task of its own. With several inputs
+    // running at once, the log of each one is collected and printed when
+    // it's done. Heading listings aren't collected, they go to stdout as
+    // they are decoded and the log goes to stderr.
+    bool buffered = lsdPaths.size() + lsaPaths.size() > 1;
+    std::mutex logMutex, listMutex;
+    bool failed = false;
+    auto convert = [&](std::function<void(std::ostream& log)> decode) {
+        std::ostringstream buffer;
+        std::ostream& log = listHeadings ? std::cerr : std::cout;
+        std::ostream& target = buffered ? buffer : log;
+        try {
+            decode(target);
+        } catch (std::exception& exc) {
+            target << "an error occured while processing dictionary: " << exc.what() << std::endl;
+            std::lock_guard<std::mutex> lock(logMutex);
+            failed = true;
+        }
+        if (buffered) {
+            std::lock_guard<std::mutex> lock(logMutex);
+            log << buffer.str();
+            log.flush();
+        }
+    };
+    TaskGroup inputs;
+    for (auto& lsdPath : lsdPaths) {
+        inputs.run([&, lsdPath] {
+            convert([&](std::ostream& log) {
+                parseLSD(lsdPath,
+                         outputPath,
+                         sourceFilter,
+                         targetFilter,
+                         options,
+                         listHeadings,
+                         log,
+                         listMutex);
+            });
+        });
+    }
+    for (auto& lsaPath : lsaPaths) {
+        inputs.run([&, lsaPath] {
+            convert([&](std::ostream& log) {
+                decodeLSA(lsaPath, outputPath, [&](int i) { log << i << std::endl; });
+            });
+        });
+    }
+    inputs.wait();
+
+    return failed ? 1 : 0;
 }
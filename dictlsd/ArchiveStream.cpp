@@ -0,0 +1,330 @@
+#include "ArchiveStream.h"
+#include "UringFileStream.h"
+#include "InflateEnd.h"
+
+#include <zlib.h>
+#include <minizip/unzip.h>
+#include <boost/filesystem.hpp>
+#include <boost/algorithm/string.hpp>
+#include <algorithm>
+#include <stdexcept>
+#include <cstring>
+
+namespace dictlsd {
+
+namespace fs = boost::filesystem;
+
+SliceStream::SliceStream(std::unique_ptr<IRandomAccessStream> source, uint64_t offset, uint64_t size)
+    : _source(std::move(source)), _offset(offset), _size(size), _cursor(this) { }
+
+unsigned SliceStream::readSome(void* dest, unsigned byteCount) {
+    return _cursor.readSome(dest, byteCount);
+}
+
+void SliceStream::seek(uint64_t pos) {
+    _cursor.seek(pos);
+}
+
+uint64_t SliceStream::tell() {
+    return _cursor.tell();
+}
+
+unsigned SliceStream::readAt(uint64_t pos, void* dest, unsigned byteCount) {
+    if (pos >= _size)
+        return 0;
+    byteCount = std::min<uint64_t>(byteCount, _size - pos);
+    return _source->readAt(_offset + pos, dest, byteCount);
+}
+
+bool SliceStream::prefetch(uint64_t pos, unsigned byteCount) {
+    return _source->prefetch(_offset + pos, byteCount);
+}
+
+InflateStream::InflateStream(std::unique_ptr<IRandomAccessStream> source,
+                             uint64_t offset,
+                             DeflateFormat format,
+                             unsigned span)
+    : _source(std::move(source)),
+      _offset(offset),
+      _format(format),
+      _span(span),
+      _builder(new z_stream()),
+      _input(1 << 16),
+      _window(32768),
+      _inRead(0),
+      _out(0),
+      _memberStart(format == DeflateFormat::Gzip),
+      _finished(false),
+      _cursor(this)
+{
+    int windowBits = format == DeflateFormat::Gzip ? 15 + 16 : -15;
+    if (inflateInit2(_builder.get(), windowBits) != Z_OK)
+        throw std::runtime_error("zlib init failed");
+    // a raw stream can be inflated from its very start, a gzip one gets its
+    // first point after the header
+    if (format == DeflateFormat::Raw) {
+        _points.push_back({0, 0, 0, {}});
+    }
+}
+
+void InflateStream::addPoint(int bits) {
+    auto& strm = *_builder;
+    AccessPoint point{_out, _inRead - strm.avail_in, bits, {}};
+    size_t written = _window.size() - strm.avail_out;
+    if (_out >= _window.size()) {
+        point.window.assign(begin(_window) + written, end(_window));
+    }
+    point.window.insert(end(point.window), begin(_window), begin(_window) + written);
+    _points.push_back(std::move(point));
+}
+
+void InflateStream::extendIndex(uint64_t pos) {
+    auto& strm = *_builder;
+    while (!_finished && (_points.empty() || _points.back().out <= pos)) {
+        if (!strm.avail_in) {
+            unsigned count = _source->readAt(_offset + _inRead, &_input[0], _input.size());
+            _inRead += count;
+            strm.next_in = &_input[0];
+            strm.avail_in = count;
+        }
+        if (!strm.avail_out) {
+            strm.next_out = &_window[0];
+            strm.avail_out = _window.size();
+        }
+        unsigned availOut = strm.avail_out;
+        int ret = inflate(&strm, Z_BLOCK);
+        _out += availOut - strm.avail_out;
+        if (ret == Z_NEED_DICT || ret == Z_DATA_ERROR || ret == Z_MEM_ERROR)
+            throw std::runtime_error("corrupted deflate stream");
+        // no progress is possible only when the input has run out
+        if (ret == Z_BUF_ERROR)
+            throw std::runtime_error("truncated deflate stream");
+        if (ret == Z_STREAM_END) {
+            // gzip files may consist of several members
+            uint8_t magic[2];
+            uint64_t next = _offset + _inRead - strm.avail_in;
+            if (_format == DeflateFormat::Gzip &&
+                _source->readAt(next, magic, 2) == 2 &&
+                magic[0] == 0x1f && magic[1] == 0x8b)
+            {
+                inflateReset(&strm);
+                _memberStart = true;
+                continue;
+            }
+            _finished = true;
+            break;
+        }
+        bool blockEnd = (strm.data_type & 128) && !(strm.data_type & 64);
+        if (blockEnd && (_memberStart || _out - _points.back().out > _span)) {
+            addPoint(strm.data_type & 7);
+            _memberStart = false;
+        }
+    }
+}
+
+std::vector<uint8_t> InflateStream::inflateSpan(AccessPoint const& point, uint64_t end) {
+    std::vector<uint8_t> data(end - point.out);
+    z_stream strm = {};
+    if (inflateInit2(&strm, -15) != Z_OK)
+        throw std::runtime_error("zlib init failed");
+    InflateEnd guard{&strm};
+    uint64_t in = point.in;
+    if (point.bits) {
+        uint8_t byte;
+        if (_source->readAt(_offset + in - 1, &byte, 1) != 1)
+            throw std::runtime_error("truncated deflate stream");
+        inflatePrime(&strm, point.bits, byte >> (8 - point.bits));
+    }
+    if (!point.window.empty()) {
+        inflateSetDictionary(&strm, point.window.data(), point.window.size());
+    }
+    std::vector<uint8_t> input(1 << 16);
+    strm.next_out = data.data();
+    strm.avail_out = data.size();
+    while (strm.avail_out) {
+        if (!strm.avail_in) {
+            unsigned count = _source->readAt(_offset + in, &input[0], input.size());
+            in += count;
+            strm.next_in = &input[0];
+            strm.avail_in = count;
+        }
+        int ret = inflate(&strm, Z_NO_FLUSH);
+        if (ret == Z_STREAM_END)
+            break;
+        if (ret == Z_BUF_ERROR)
+            throw std::runtime_error("truncated deflate stream");
+        if (ret != Z_OK)
+            throw std::runtime_error("corrupted deflate stream");
+    }
+    if (strm.avail_out)
+        throw std::runtime_error("truncated deflate stream");
+    return data;
+}
+
+InflateStream::SpanPtr InflateStream::span(uint64_t pos, uint64_t& start) {
+    AccessPoint const* point;
+    uint64_t spanEnd;
+    size_t index;
+    {
+        std::lock_guard<std::mutex> lock(_mutex);
+        extendIndex(pos);
+        auto it = std::upper_bound(begin(_points), end(_points), pos,
+            [](uint64_t value, AccessPoint const& point) { return value < point.out; });
+        if (it == begin(_points))
+            return nullptr;
+        if (it == end(_points)) {
+            if (pos >= _out)
+                return nullptr;
+            spanEnd = _out;
+        } else {
+            spanEnd = it->out;
+        }
+        index = it - begin(_points) - 1;
+        // deque elements stay put as the index grows
+        point = &_points[index];
+        start = point->out;
+        for (auto cached = begin(_cache); cached != end(_cache); ++cached) {
+            if (cached->first == index) {
+                _cache.splice(begin(_cache), _cache, cached);
+                return cached->second;
+            }
+        }
+    }
+    auto data = std::make_shared<std::vector<uint8_t>>(inflateSpan(*point, spanEnd));
+    std::lock_guard<std::mutex> lock(_mutex);
+    _cache.push_front({index, data});
+    if (_cache.size() > 8) {
+        _cache.pop_back();
+    }
+    return data;
+}
+
+unsigned InflateStream::readSome(void* dest, unsigned byteCount) {
+    return _cursor.readSome(dest, byteCount);
+}
+
+void InflateStream::seek(uint64_t pos) {
+    _cursor.seek(pos);
+}
+
+uint64_t InflateStream::tell() {
+    return _cursor.tell();
+}
+
+unsigned InflateStream::readAt(uint64_t pos, void* dest, unsigned byteCount) {
+    auto out = static_cast<uint8_t*>(dest);
+    unsigned total = 0;
+    while (total < byteCount) {
+        uint64_t start;
+        auto data = span(pos + total, start);
+        if (!data)
+            break;
+        uint64_t offset = pos + total - start;
+        unsigned count = std::min<uint64_t>(byteCount - total, data->size() - offset);
+        memcpy(out + total, data->data() + offset, count);
+        total += count;
+    }
+    return total;
+}
+
+InflateStream::~InflateStream() {
+    inflateEnd(_builder.get());
+}
+
+std::unique_ptr<IRandomAccessStream> openFile(std::string const& path, FilePool* pool) {
+    if (pool)
+        return std::unique_ptr<IRandomAccessStream>(new PooledFileStream(pool, path));
+    return std::unique_ptr<IRandomAccessStream>(new UringFileStream(path));
+}
+
+struct ZipCloser {
+    unzFile zip;
+    ~ZipCloser() {
+        unzClose(zip);
+    }
+};
+
+unzFile openZip(std::string const& zipPath) {
+    unzFile zip = unzOpen64(zipPath.c_str());
+    if (!zip)
+        throw std::runtime_error("can't open zip file " + zipPath);
+    return zip;
+}
+
+std::unique_ptr<IRandomAccessStream> openZipEntry(std::string const& zipPath,
+                                                  std::string const& entry,
+                                                  FilePool* pool)
+{
+    ZipCloser zip{openZip(zipPath)};
+    if (unzLocateFile(zip.zip, entry.c_str(), 0) != UNZ_OK)
+        throw std::runtime_error("can't find " + entry + " in " + zipPath);
+    unz_file_info64 info;
+    if (unzGetCurrentFileInfo64(zip.zip, &info, nullptr, 0, nullptr, 0, nullptr, 0) != UNZ_OK)
+        throw std::runtime_error("can't read zip entry " + entry);
+    if (info.flag & 1)
+        throw std::runtime_error("encrypted zip entries aren't supported");
+    int method, level;
+    if (unzOpenCurrentFile2(zip.zip, &method, &level, 1) != UNZ_OK)
+        throw std::runtime_error("can't read zip entry " + entry);
+    uint64_t offset = unzGetCurrentFileZStreamPos64(zip.zip);
+    unzCloseCurrentFile(zip.zip);
+    auto file = openFile(zipPath, pool);
+    if (info.compression_method == 0) {
+        return std::unique_ptr<IRandomAccessStream>(
+            new SliceStream(std::move(file), offset, info.uncompressed_size));
+    }
+    if (info.compression_method == Z_DEFLATED) {
+        return std::unique_ptr<IRandomAccessStream>(
+            new InflateStream(std::move(file), offset, DeflateFormat::Raw));
+    }
+    throw std::runtime_error("unsupported compression method of zip entry " + entry);
+}
+
+std::unique_ptr<IRandomAccessStream> openDictionaryStream(std::string const& path,
+                                                          FilePool* pool)
+{
+    auto lower = boost::algorithm::to_lower_copy(path);
+    for (size_t i = lower.find(".zip"); i != std::string::npos; i = lower.find(".zip", i + 1)) {
+        size_t split = i + 4;
+        if (split < path.size() && (path[split] == '/' || path[split] == '\\') &&
+            fs::is_regular_file(path.substr(0, split)))
+        {
+            auto entry = path.substr(split + 1);
+            std::replace(begin(entry), end(entry), '\\', '/');
+            return openZipEntry(path.substr(0, split), entry, pool);
+        }
+    }
+    if (boost::algorithm::ends_with(lower, ".gz")) {
+        return std::unique_ptr<IRandomAccessStream>(
+            new InflateStream(openFile(path, pool), 0, DeflateFormat::Gzip));
+    }
+    return openFile(path, pool);
+}
+
+std::vector<std::string> listArchiveDictionaries(std::string const& zipPath) {
+    ZipCloser zip{openZip(zipPath)};
+    std::vector<std::string> names;
+    for (int ret = unzGoToFirstFile(zip.zip); ret == UNZ_OK; ret = unzGoToNextFile(zip.zip)) {
+        unz_file_info64 info;
+        if (unzGetCurrentFileInfo64(zip.zip, &info, nullptr, 0, nullptr, 0, nullptr, 0) != UNZ_OK)
+            throw std::runtime_error("can't read zip file " + zipPath);
+        std::vector<char> name(info.size_filename + 1);
+        unzGetCurrentFileInfo64(zip.zip, &info, name.data(), name.size(), nullptr, 0, nullptr, 0);
+        std::string entry(name.data(), info.size_filename);
+        auto lower = boost::algorithm::to_lower_copy(entry);
+        if (boost::algorithm::ends_with(lower, ".lsd") || boost::algorithm::ends_with(lower, ".lsa")) {
+            names.push_back(entry);
+        }
+    }
+    return names;
+}
+
+std::string dictionaryFileName(std::string const& path) {
+    auto name = fs::path(path).filename().string();
+    if (boost::algorithm::iends_with(name, ".gz")) {
+        name.resize(name.size() - 3);
+    }
+    return name;
+}
+
+}
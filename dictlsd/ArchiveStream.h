@@ -0,0 +1,87 @@
+#pragma once
+
+#include "BitStream.h"
+#include "FilePool.h"
+#include <string>
+#include <vector>
+#include <deque>
+#include <list>
+#include <memory>
+#include <mutex>
+
+struct z_stream_s;
+
+namespace dictlsd {
+
+// A window into another stream, such as a stored zip entry.
+class SliceStream : public IRandomAccessStream {
+    std::unique_ptr<IRandomAccessStream> _source;
+    uint64_t _offset;
+    uint64_t _size;
+    StreamCursor _cursor;
+public:
+    SliceStream(std::unique_ptr<IRandomAccessStream> source, uint64_t offset, uint64_t size);
+    virtual unsigned readSome(void* dest, unsigned byteCount) override;
+    virtual void seek(uint64_t pos) override;
+    virtual uint64_t tell() override;
+    virtual unsigned readAt(uint64_t pos, void* dest, unsigned byteCount) override;
+    virtual bool prefetch(uint64_t pos, unsigned byteCount) override;
+};
+
+enum class DeflateFormat { Raw, Gzip };
+
+// Random access into a deflate stream, either raw as in zip entries or
+// gzip. As in zlib's zran example, an access point is recorded about every
+// span bytes of output together with the 32 KiB window needed to restart
+// inflating there. The index only grows as far as the reads reach, a read
+// inflates from the nearest point, and the last few spans are cached.
+class InflateStream : public IRandomAccessStream {
+    struct AccessPoint {
+        uint64_t out;
+        uint64_t in;
+        int bits;
+        std::vector<uint8_t> window;
+    };
+    typedef std::shared_ptr<std::vector<uint8_t>> SpanPtr;
+    std::unique_ptr<IRandomAccessStream> _source;
+    uint64_t _offset;
+    DeflateFormat _format;
+    unsigned _span;
+    std::mutex _mutex;
+    std::deque<AccessPoint> _points;
+    std::unique_ptr<z_stream_s> _builder;
+    std::vector<uint8_t> _input;
+    std::vector<uint8_t> _window;
+    uint64_t _inRead;
+    uint64_t _out;
+    bool _memberStart;
+    bool _finished;
+    std::list<std::pair<size_t, SpanPtr>> _cache;
+    StreamCursor _cursor;
+    void extendIndex(uint64_t pos);
+    void addPoint(int bits);
+    SpanPtr span(uint64_t pos, uint64_t& start);
+    std::vector<uint8_t> inflateSpan(AccessPoint const& point, uint64_t end);
+public:
+    InflateStream(std::unique_ptr<IRandomAccessStream> source,
+                  uint64_t offset,
+                  DeflateFormat format,
+                  unsigned span = 1 << 20);
+    virtual unsigned readSome(void* dest, unsigned byteCount) override;
+    virtual void seek(uint64_t pos) override;
+    virtual uint64_t tell() override;
+    virtual unsigned readAt(uint64_t pos, void* dest, unsigned byteCount) override;
+    ~InflateStream();
+};
+
+// Opens a plain dictionary file, a gzipped one (.gz) or a zip archive entry
+// given as archive.zip/path/in/archive.lsd. Files are opened through the
+// pool if there is one.
+std::unique_ptr<IRandomAccessStream> openDictionaryStream(std::string const& path,
+                                                          FilePool* pool = nullptr);
+// the .lsd and .lsa entries of a zip archive
+std::vector<std::string> listArchiveDictionaries(std::string const& zipPath);
+// the file name of a dictionary path without the .gz suffix
+std::string dictionaryFileName(std::string const& path);
+
+}
@@ -10,50 +10,47 @@
 
 namespace dictlsd {
 
-void ArticleHeading::makeCharsFromPairs(std::deque<ExtPair>& pairs, std::u16string const& text) {
-    std::deque<char16_t> textDeque(begin(text), end(text));
-    size_t idx = 0;
-    _chars.reserve(pairs.size());
+// Merges the decoded text with the unsorted ext pairs, calling emit for each
+// resulting character.
+template <typename F>
+void foreachHeadingChar(std::vector<ExtPair> const& pairs, std::u16string const& text, F emit) {
+    size_t idx = 0, pair = 0, pos = 0;
+    auto hasNext = [&] {
+        return pos < text.size() || pair < pairs.size();
+    };
     auto nextChar = [&](char16_t& chr) {
-        if (!pairs.empty() && pairs.front().idx == idx) {
-            chr = pairs.front().chr;
-            pairs.pop_front();
+        if (pair < pairs.size() && (pairs[pair].idx == idx || pos == text.size())) {
+            chr = pairs[pair++].chr;
             return false;
         }
-        chr = textDeque.front();
-        textDeque.pop_front();
+        chr = text[pos++];
         return true;
     };
 
-    while (!textDeque.empty() || !pairs.empty()) {
+    while (hasNext()) {
         CharInfo info;
         info.escaped = false;
         info.sorted = nextChar(info.chr);
-        if (info.chr == '\\') {
+        if (info.chr == '\\' && hasNext()) {
             idx++;
             info.sorted = nextChar(info.chr);
             info.escaped = true;
         }
-        _chars.push_back(info);
+        emit(info);
         idx++;
     }
 }
 
-bool ArticleHeading::Load(
-        IDictionaryDecoder &decoder,
-        IBitStream &bstr,
-        std::u16string &knownPrefix)
-{
-    std::u16string text;
-    std::deque<ExtPair> pairs;
+void ArticleHeading::makeCharsFromPairs(std::vector<ExtPair> const& pairs, std::u16string const& text) {
+    _chars.clear();
+    _chars.reserve(text.size() + pairs.size());
+    foreachHeadingChar(pairs, text, [&](CharInfo const& info) {
+        _chars.push_back(info);
+    });
+}
 
-    unsigned prefixLen;
-    decoder.DecodePrefixLen(bstr, prefixLen);
-    unsigned postfixLen;
-    decoder.DecodePostfixLen(bstr, postfixLen);
-    decoder.DecodeHeading(&bstr, postfixLen, text);
-    decoder.ReadReference2(bstr, _reference);
-    knownPrefix = knownPrefix.substr(0, prefixLen) + text;
+void readExtPairs(IBitStream& bstr, std::vector<ExtPair>& pairs) {
+    pairs.clear();
     if (bstr.read(1)) {
         unsigned len = bstr.read(8);
         for (unsigned i = 0; i < len; ++i) {
@@ -62,7 +59,62 @@ bool ArticleHeading::Load(
             pairs.push_back({idx, chr});
         }
     }
-    makeCharsFromPairs(pairs, knownPrefix);
+}
+
+// Decodes the next heading into the arena: arena.prefix becomes the full
+// decoded text and arena.pairs its unsorted characters.
+void decodeHeadingParts(IDictionaryDecoder& decoder,
+                        IBitStream& bstr,
+                        HeadingDecodeArena& arena,
+                        unsigned& reference)
+{
+    unsigned prefixLen;
+    decoder.DecodePrefixLen(bstr, prefixLen);
+    unsigned postfixLen;
+    decoder.DecodePostfixLen(bstr, postfixLen);
+    decoder.DecodeHeading(&bstr, postfixLen, arena.text);
+    decoder.ReadReference2(bstr, reference);
+    arena.prefix.resize(std::min<size_t>(prefixLen, arena.prefix.size()));
+    arena.prefix += arena.text;
+    readExtPairs(bstr, arena.pairs);
+}
+
+bool ArticleHeading::Load(
+        IDictionaryDecoder &decoder,
+        IBitStream &bstr,
+        HeadingDecodeArena& arena)
+{
+    _dslText.clear();
+    decodeHeadingParts(decoder, bstr, arena, _reference);
+    makeCharsFromPairs(arena.pairs, arena.prefix);
+    return true;
+}
+
+bool ArticleHeading::Load(
+        IDictionaryDecoder &decoder,
+        IBitStream &bstr,
+        std::u16string &knownPrefix)
+{
+    HeadingDecodeArena arena;
+    std::swap(arena.prefix, knownPrefix);
+    Load(decoder, bstr, arena);
+    std::swap(arena.prefix, knownPrefix);
+    return true;
+}
+
+bool loadPlainHeading(IDictionaryDecoder& decoder,
+                      IBitStream& bstr,
+                      HeadingDecodeArena& arena,
+                      std::u16string& text,
+                      unsigned& reference)
+{
+    decodeHeadingParts(decoder, bstr, arena, reference);
+    text.clear();
+    foreachHeadingChar(arena.pairs, arena.prefix, [&](CharInfo const& info) {
+        if (info.sorted) {
+            text += info.chr;
+        }
+    });
     return true;
 }
 
@@ -76,24 +128,26 @@ std::u16string ArticleHeading::text() const {
     return text;
 }
 
-std::u16string ArticleHeading::dslText() {
-    std::u16string extText;
-    extText.clear();
+std::u16string const& ArticleHeading::dslText() {
+    if (!_dslText.empty() || _chars.empty())
+        return _dslText;
+    std::u16string& extText = _dslText;
+    extText.reserve(_chars.size() + 2);
     bool group = false;
     for (CharInfo& info : _chars) {
         if (group && info.sorted) {
-            extText += u"}";
+            extText += u'}';
             group = false;
         } else if (!group && !info.sorted) {
-            extText += u"{";
+            extText += u'{';
             group = true;
         }
         if (info.escaped)
-            extText += '\\';
+            extText += u'\\';
         extText += info.chr;
     }
     if (group) {
-        extText += u"}";
+        extText += u'}';
     }
     return extText;
 }
@@ -207,8 +261,6 @@ bool tryCollapse(ArticleHeading& variant1,
                  Matcher matcherA,
                  Matcher matcherB)
 {
-    variant1.dslText();
-    variant2.dslText();
     CharVec const& chars1 = variant1._chars;
     CharVec const& chars2 = variant2._chars;
     CharVec aleft, amiddle, aright;
@@ -226,6 +278,7 @@ bool tryCollapse(ArticleHeading& variant1,
     {
         collapsed = variant1;
         collapsed._chars.clear();
+        collapsed._dslText.clear();
         append(collapsed._chars, bleft);
         append(collapsed._chars, beforeMiddle);
         append(collapsed._chars, bmiddle);
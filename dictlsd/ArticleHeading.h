@@ -2,8 +2,8 @@
 
 #include "BitStream.h"
 #include <string>
-#include <deque>
 #include <functional>
+#include <vector>
 
 namespace dictlsd {
 
@@ -19,15 +19,27 @@ struct CharInfo {
     bool operator==(const CharInfo& other) const;
 };
 
+// Scratch buffers reused while decoding consecutive headings of a page, so the
+// decoding itself does not allocate per heading. Not to be shared between
+// threads; clear the prefix before the first heading of every page.
+struct HeadingDecodeArena {
+    std::u16string prefix;
+    std::u16string text;
+    std::vector<ExtPair> pairs;
+};
+
 typedef std::vector<CharInfo> CharVec;
 typedef std::function<bool(CharVec const& chars, CharVec& left, CharVec& middle, CharVec& right)> Matcher;
 
 class IDictionaryDecoder;
+class FrontCodedHeadings;
 class ArticleHeading {
     std::vector<CharInfo> _chars;
     unsigned _reference;
+    std::u16string _dslText; // built on demand, cleared whenever _chars changes
     void makeExtTextFromChars();
-    void makeCharsFromPairs(std::deque<ExtPair>& pairs, std::u16string const& text);
+    void makeCharsFromPairs(std::vector<ExtPair> const& pairs, std::u16string const& text);
+    friend class FrontCodedHeadings;
     friend void collapseVariants(std::vector<ArticleHeading> &);
     friend bool tryCollapse(ArticleHeading& variant1,
                             ArticleHeading& variant2,
@@ -40,11 +52,22 @@ public:
     bool Load(IDictionaryDecoder& decoder,
               IBitStream& bstr,
               std::u16string& knownPrefix);
+    bool Load(IDictionaryDecoder& decoder,
+              IBitStream& bstr,
+              HeadingDecodeArena& arena);
     std::u16string text() const;
-    std::u16string dslText();
+    std::u16string const& dslText();
     unsigned articleReference() const;
 };
 
+// Decodes the next heading of a leaf page into its plain (sorted) text only.
+// The ext pairs are still read to keep the stream aligned, but no CharInfo
+// vector is built.
+bool loadPlainHeading(IDictionaryDecoder& decoder,
+                      IBitStream& bstr,
+                      HeadingDecodeArena& arena,
+                      std::u16string& text,
+                      unsigned& reference);
 void collapseVariants(std::vector<ArticleHeading> &headings);
 void groupHeadingsByReference(std::vector<ArticleHeading>& headings);
 typedef std::vector<ArticleHeading>::iterator ArticleHeadingIter;
@@ -6,6 +6,7 @@
 #include <stdint.h>
 #include <functional>
 #include <cstring>
+#include <algorithm>
 
 namespace dictlsd {
 
@@ -42,16 +43,29 @@ unsigned BitStreamAdapter::readSome(void *dest, unsigned byteCount) {
     return _ras->readSome(dest, byteCount);
 }
 
-void BitStreamAdapter::seek(unsigned pos) {
+void BitStreamAdapter::seek(uint64_t pos) {
     _ras->seek(pos);
     _bitPos = 0;
 }
 
+unsigned BitStreamAdapter::readAt(uint64_t pos, void* dest, unsigned byteCount) {
+    return _ras->readAt(pos, dest, byteCount);
+}
+
+bool BitStreamAdapter::prefetch(uint64_t pos, unsigned byteCount) {
+    return _ras->prefetch(pos, byteCount);
+}
+
+void BitStreamAdapter::readBatch(std::vector<ReadRequest>& requests,
+                                 std::function<void(ReadRequest&)> done) {
+    _ras->readBatch(requests, done);
+}
+
 void BitStreamAdapter::toNearestByte() {
     _bitPos = 0;
 }
 
-unsigned BitStreamAdapter::tell() {
+uint64_t BitStreamAdapter::tell() {
     return _ras->tell();
 }
 
@@ -65,15 +79,155 @@ unsigned InMemoryStream::readSome(void *dest, unsigned byteCount) {
     return byteCount;
 }
 
-void InMemoryStream::seek(unsigned pos) {
+void InMemoryStream::seek(uint64_t pos) {
     assert(pos <= _size);
     _pos = pos;
 }
 
-unsigned InMemoryStream::tell() {
+uint64_t InMemoryStream::tell() {
     return _pos;
 }
 
+unsigned InMemoryStream::readAt(uint64_t pos, void* dest, unsigned byteCount) {
+    if (pos >= _size)
+        return 0;
+    byteCount = std::min<uint64_t>(byteCount, _size - pos);
+    memcpy(dest, _buf + pos, byteCount);
+    return byteCount;
+}
+
+bool InMemoryStream::prefetch(uint64_t, unsigned) {
+    return true;
+}
+
+StreamCursor::StreamCursor(IRandomAccessStream* ras, unsigned bufferSize)
+    : _ras(ras), _buf(bufferSize), _bufStart(0), _bufSize(0), _pos(0) { }
+
+unsigned StreamCursor::readSome(void* dest, unsigned byteCount) {
+    auto out = static_cast<uint8_t*>(dest);
+    unsigned total = 0;
+    while (total < byteCount) {
+        if (_pos >= _bufStart && _pos < _bufStart + _bufSize) {
+            unsigned offset = _pos - _bufStart;
+            unsigned count = std::min(byteCount - total, _bufSize - offset);
+            memcpy(out + total, &_buf[offset], count);
+            total += count;
+            _pos += count;
+            continue;
+        }
+        unsigned rest = byteCount - total;
+        if (rest >= _buf.size()) {
+            unsigned bytesRead = _ras->readAt(_pos, out + total, rest);
+            total += bytesRead;
+            _pos += bytesRead;
+            break;
+        }
+        _bufStart = _pos;
+        _bufSize = _ras->readAt(_pos, &_buf[0], _buf.size());
+        if (!_bufSize)
+            break;
+    }
+    return total;
+}
+
+void StreamCursor::seek(uint64_t pos) {
+    _pos = pos;
+}
+
+uint64_t StreamCursor::tell() {
+    return _pos;
+}
+
+unsigned StreamCursor::readAt(uint64_t pos, void* dest, unsigned byteCount) {
+    return _ras->readAt(pos, dest, byteCount);
+}
+
+bool StreamCursor::prefetch(uint64_t pos, unsigned byteCount) {
+    return _ras->prefetch(pos, byteCount);
+}
+
+void StreamCursor::readBatch(std::vector<ReadRequest>& requests,
+                             std::function<void(ReadRequest&)> done) {
+    _ras->readBatch(requests, done);
+}
+
+PrefetchStream::PrefetchStream(IRandomAccessStream* ras, TaskScheduler& scheduler)
+    : _ras(ras), _cursor(ras), _draining(false), _stop(false), _tasks(scheduler) { }
+
+void PrefetchStream::drain() {
+    std::vector<uint8_t> scratch(1 << 16);
+    std::unique_lock<std::mutex> lock(_mutex);
+    while (!_stop && !_queue.empty()) {
+        auto range = _queue.front();
+        _queue.pop_front();
+        lock.unlock();
+        try {
+            while (range.second) {
+                unsigned count = std::min<unsigned>(range.second, scratch.size());
+                if (!_ras->readAt(range.first, &scratch[0], count))
+                    break;
+                range.first += count;
+                range.second -= count;
+            }
+        } catch (std::exception&) {
+            // it's only a hint, the actual read will report the error
+        }
+        lock.lock();
+    }
+    _draining = false;
+}
+
+unsigned PrefetchStream::readSome(void* dest, unsigned byteCount) {
+    return _cursor.readSome(dest, byteCount);
+}
+
+void PrefetchStream::seek(uint64_t pos) {
+    _cursor.seek(pos);
+}
+
+uint64_t PrefetchStream::tell() {
+    return _cursor.tell();
+}
+
+unsigned PrefetchStream::readAt(uint64_t pos, void* dest, unsigned byteCount) {
+    return _ras->readAt(pos, dest, byteCount);
+}
+
+bool PrefetchStream::prefetch(uint64_t pos, unsigned byteCount) {
+    if (_ras->prefetch(pos, byteCount))
+        return true;
+    std::lock_guard<std::mutex> lock(_mutex);
+    _queue.push_back({pos, byteCount});
+    if (!_draining) {
+        _draining = true;
+        _tasks.run([this] { drain(); });
+    }
+    return true;
+}
+
+void PrefetchStream::readBatch(std::vector<ReadRequest>& requests,
+                               std::function<void(ReadRequest&)> done) {
+    _ras->readBatch(requests, done);
+}
+
+PrefetchStream::~PrefetchStream() {
+    // the task group then only waits for a read in progress
+    std::lock_guard<std::mutex> lock(_mutex);
+    _stop = true;
+}
+
+bool IRandomAccessStream::prefetch(uint64_t, unsigned) {
+    return false;
+}
+
+void IRandomAccessStream::readBatch(std::vector<ReadRequest>& requests,
+                                    std::function<void(ReadRequest&)> done) {
+    for (auto& request : requests) {
+        request.bytesRead = readAt(request.pos, request.dest, request.byteCount);
+        done(request);
+    }
+}
+
 IRandomAccessStream::~IRandomAccessStream() { }
 
 unsigned char xor_pad[256] = {
@@ -112,7 +266,7 @@ unsigned char xor_pad[256] = {
 };
 
 XoringStreamAdapter::XoringStreamAdapter(IRandomAccessStream* ras)
-    : BitStreamAdapter(ras), _key(0x7f) { }
+    : BitStreamAdapter(ras), _key(0x7f), _start(ras->tell()) { }
 
 unsigned XoringStreamAdapter::readSome(void *dest, unsigned byteCount) {
     unsigned bytesRead = BitStreamAdapter::readSome(dest, byteCount);
@@ -125,24 +279,53 @@ unsigned XoringStreamAdapter::readSome(void *dest, unsigned byteCount) {
     return bytesRead;
 }
 
-void XoringStreamAdapter::seek(unsigned pos) {
+void XoringStreamAdapter::seek(uint64_t pos) {
     BitStreamAdapter::seek(pos);
     _key = 0x7f;
+    _start = pos;
+}
+
+unsigned XoringStreamAdapter::readAt(uint64_t pos, void* dest, unsigned byteCount) {
+    if (pos < _start)
+        throw std::logic_error("read before the start of the xored region");
+    unsigned char key = 0x7f;
+    if (pos > _start) {
+        unsigned char prev;
+        if (BitStreamAdapter::readAt(pos - 1, &prev, 1) != 1)
+            return 0;
+        key = xor_pad[prev];
+    }
+    unsigned bytesRead = BitStreamAdapter::readAt(pos, dest, byteCount);
+    auto bytes = static_cast<unsigned char*>(dest);
+    for (unsigned i = 0; i < bytesRead; ++i) {
+        unsigned char byte = bytes[i];
+        bytes[i] ^= key;
+        key = xor_pad[byte];
+    }
+    return bytesRead;
 }
 
 FileStream::FileStream(std::string path)
-    : _file(path, false) { }
+    : _file(path, false), _cursor(this) { }
 
 unsigned FileStream::readSome(void *dest, unsigned byteCount) {
-    return _file.read(reinterpret_cast<char*>(dest), byteCount);
+    return _cursor.readSome(dest, byteCount);
+}
+
+void FileStream::seek(uint64_t pos) {
+    _cursor.seek(pos);
+}
+
+uint64_t FileStream::tell() {
+    return _cursor.tell();
 }
 
-void FileStream::seek(unsigned pos) {
-    _file.seek(pos);
+unsigned FileStream::readAt(uint64_t pos, void* dest, unsigned byteCount) {
+    return _file.readAt(pos, reinterpret_cast<char*>(dest), byteCount);
 }
 
-unsigned FileStream::tell() {
-    return _file.tell();
+bool FileStream::prefetch(uint64_t pos, unsigned byteCount) {
+    return _file.willNeed(pos, byteCount);
 }
 
 }
@@ -1,16 +1,38 @@
 #pragma once
 
 #include "UnicodePathFile.h"
+#include "TaskScheduler.h"
 #include <vector>
 #include <iostream>
+#include <stdint.h>
+#include <deque>
+#include <mutex>
+#include <functional>
 
 namespace dictlsd {
 
+struct ReadRequest {
+    uint64_t pos;
+    void* dest;
+    unsigned byteCount;
+    unsigned bytesRead;
+};
+
 class IRandomAccessStream {
 public:
     virtual unsigned readSome(void* dest, unsigned byteCount) = 0;
-    virtual void seek(unsigned pos) = 0;
-    virtual unsigned tell() = 0;
+    virtual void seek(uint64_t pos) = 0;
+    virtual uint64_t tell() = 0;
+    // reads at an absolute position without touching the stream position,
+    // safe to call from several threads at once
+    virtual unsigned readAt(uint64_t pos, void* dest, unsigned byteCount) = 0;
+    // hints that the range will be read soon, returns false if the stream
+    // can't pass the hint on
+    virtual bool prefetch(uint64_t pos, unsigned byteCount);
+    // reads all the requests and calls done for each one as it completes,
+    // in no particular order; thread safety is the same as for readAt
+    virtual void readBatch(std::vector<ReadRequest>& requests,
+                           std::function<void(ReadRequest&)> done);
     virtual ~IRandomAccessStream();
 };
 
@@ -31,17 +53,26 @@ public:
     BitStreamAdapter(IRandomAccessStream* ras);
     virtual unsigned read(unsigned len) override;
     virtual unsigned readSome(void* dest, unsigned byteCount) override;
-    virtual void seek(unsigned pos) override;
+    virtual void seek(uint64_t pos) override;
     virtual void toNearestByte() override;
-    virtual unsigned tell() override;
+    virtual uint64_t tell() override;
+    virtual unsigned readAt(uint64_t pos, void* dest, unsigned byteCount) override;
+    virtual bool prefetch(uint64_t pos, unsigned byteCount) override;
+    virtual void readBatch(std::vector<ReadRequest>& requests,
+                           std::function<void(ReadRequest&)> done) override;
 };
 
+// Each key depends only on the previous encrypted byte, so the chain
+// starts over at the position the stream had when the adapter was created or
+// last seeked.
 class XoringStreamAdapter : public BitStreamAdapter {
     unsigned char _key;
+    uint64_t _start;
 public:
     XoringStreamAdapter(IRandomAccessStream* bstr);
     virtual unsigned readSome(void* dest, unsigned byteCount) override;
-    virtual void seek(unsigned pos) override;
+    virtual void seek(uint64_t pos) override;
+    virtual unsigned readAt(uint64_t pos, void* dest, unsigned byteCount) override;
 };
 
 class InMemoryStream : public IRandomAccessStream {
@@ -51,17 +82,70 @@ class InMemoryStream : public IRandomAccessStream {
 public:
     InMemoryStream(const void* buf, unsigned size);
     virtual unsigned readSome(void* dest, unsigned byteCount) override;
-    virtual void seek(unsigned pos) override;
-    virtual unsigned tell() override;
+    virtual void seek(uint64_t pos) override;
+    virtual uint64_t tell() override;
+    virtual unsigned readAt(uint64_t pos, void* dest, unsigned byteCount) override;
+    virtual bool prefetch(uint64_t pos, unsigned byteCount) override;
+};
+
+// A private position and read buffer on top of a shared stream. All reads go
+// through readAt, so any number of cursors can work on the same stream
+// concurrently.
+class StreamCursor : public IRandomAccessStream {
+    IRandomAccessStream* _ras;
+    std::vector<uint8_t> _buf;
+    uint64_t _bufStart;
+    unsigned _bufSize;
+    uint64_t _pos;
+public:
+    StreamCursor(IRandomAccessStream* ras, unsigned bufferSize = 4096);
+    virtual unsigned readSome(void* dest, unsigned byteCount) override;
+    virtual void seek(uint64_t pos) override;
+    virtual uint64_t tell() override;
+    virtual unsigned readAt(uint64_t pos, void* dest, unsigned byteCount) override;
+    virtual bool prefetch(uint64_t pos, unsigned byteCount) override;
+    virtual void readBatch(std::vector<ReadRequest>& requests,
+                           std::function<void(ReadRequest&)> done) override;
+};
+
+// Passes prefetch hints on to the underlying stream. Ranges the stream can't
+// hint to the OS are read ahead by a task of the scheduler instead, so that
+// the data is cached by the time the decoder gets to it. One task at a time
+// works through the ranges in the order they were hinted.
+class PrefetchStream : public IRandomAccessStream {
+    IRandomAccessStream* _ras;
+    StreamCursor _cursor;
+    std::deque<std::pair<uint64_t, unsigned>> _queue;
+    std::mutex _mutex;
+    bool _draining;
+    bool _stop;
+    // destroyed first, so that no task outlives the queue
+    TaskGroup _tasks;
+    void drain();
+public:
+    PrefetchStream(IRandomAccessStream* ras, TaskScheduler& scheduler = TaskScheduler::global());
+    virtual unsigned readSome(void* dest, unsigned byteCount) override;
+    virtual void seek(uint64_t pos) override;
+    virtual uint64_t tell() override;
+    virtual unsigned readAt(uint64_t pos, void* dest, unsigned byteCount) override;
+    virtual bool prefetch(uint64_t pos, unsigned byteCount) override;
+    virtual void readBatch(std::vector<ReadRequest>& requests,
+                           std::function<void(ReadRequest&)> done) override;
+    ~PrefetchStream();
 };
 
 class FileStream : public IRandomAccessStream {
+protected:
     UnicodePathFile _file;
+private:
+    StreamCursor _cursor;
 public:
     FileStream(std::string path);
-    virtual unsigned readSome(void *dest, unsigned byteCount);
-    virtual void seek(unsigned pos);
-    virtual unsigned tell();
+    virtual unsigned readSome(void *dest, unsigned byteCount) override;
+    virtual void seek(uint64_t pos) override;
+    virtual uint64_t tell() override;
+    virtual unsigned readAt(uint64_t pos, void* dest, unsigned byteCount) override;
+    virtual bool prefetch(uint64_t pos, unsigned byteCount) override;
 };
 
 }
@@ -63,6 +63,20 @@ NodePageBody parseNodePageBody(
 }
 
 
+void decodeLeafPageBody(
+        IBitStream &bstr,
+        IDictionaryDecoder &decoder,
+        unsigned count,
+        HeadingDecodeArena& arena,
+        std::vector<ArticleHeading>& headings)
+{
+    arena.prefix.clear();
+    for (unsigned i = 0; i < count; ++i) {
+        headings.emplace_back();
+        headings.back().Load(decoder, bstr, arena);
+    }
+}
+
 std::vector<ArticleHeading> parseLeafPageBody(
         IBitStream &bstr,
         IDictionaryDecoder &decoder,
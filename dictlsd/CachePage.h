@@ -33,6 +33,13 @@ struct NodePageBody {
     std::vector<std::u16string> prefixes;
 };
 
+// Appends the headings of a leaf page body to headings, decoding them through
+// the given arena.
+void decodeLeafPageBody(IBitStream& bstr,
+                        IDictionaryDecoder& decoder,
+                        unsigned count,
+                        HeadingDecodeArena& arena,
+                        std::vector<ArticleHeading>& headings);
 std::vector<ArticleHeading> parseLeafPageBody(IBitStream& bstr, IDictionaryDecoder& decoder, unsigned count, std::u16string knownPrefix);
 NodePageBody parseNodePageBody(IBitStream& bstr, IDictionaryDecoder& decoder, unsigned count);
 
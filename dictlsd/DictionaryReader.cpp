@@ -84,11 +84,11 @@ std::u16string DictionaryReader::prefix() const {
     return _decoder->Prefix();
 }
 
-std::u16string DictionaryReader::annotation() const {
+std::u16string DictionaryReader::annotation(IBitStream& bstr) const {
     loadDecoder();
-    _bstr->seek(_header.annotationOffset);
+    bstr.seek(_header.annotationOffset);
     std::u16string anno;
-    bool decoded = _decoder->DecodeArticle(_bstr, anno);
+    bool decoded = _decoder->DecodeArticle(&bstr, anno);
     if (!decoded)
         throw std::runtime_error("can't decode annotation");
     return anno;
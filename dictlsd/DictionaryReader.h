@@ -26,18 +26,18 @@ class DictionaryReader {
     void readOverlay();
     bool _isSupported;
     mutable bool _decoderLoaded;
-    void loadDecoder() const;
 public:
     DictionaryReader(IBitStream* bitstream);
     bool supported() const;
     std::u16string name() const;
     std::u16string prefix() const;
-    std::u16string annotation() const;
+    std::u16string annotation(IBitStream& bstr) const;
     unsigned pagesCount() const;
     unsigned overlayHeadingsOffset() const;
     unsigned overlayDataOffset() const;
     std::vector<unsigned char> const& icon() const;
     std::u16string decodeArticle(IBitStream& bstr, unsigned reference);
+    void loadDecoder() const;
     IDictionaryDecoder* decoder();
     LSDHeader const& header() const;
 };
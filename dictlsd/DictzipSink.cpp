@@ -0,0 +1,161 @@
+#include "DictzipSink.h"
+
+#include <zlib.h>
+#include <algorithm>
+#include <stdexcept>
+#include <cstring>
+
+namespace dictlsd {
+
+// the RA field has to fit the 16 bit extra field length
+const size_t maxChunks = (0xffff - 10) / 2;
+// the fixed part, the extra field with the largest RA and an empty comment
+const size_t maxHeaderSize = 12 + 10 + 2 * maxChunks + 1;
+
+void putLe(std::vector<char>& out, unsigned value, unsigned bytes) {
+    for (unsigned i = 0; i < bytes; ++i) {
+        out.push_back(static_cast<char>(value >> (8 * i)));
+    }
+}
+
+DictzipSink::DictzipSink(std::string path, TaskScheduler& scheduler)
+    : _out(new OutputSink(path)),
+      _headerReserved(false),
+      _batches(scheduler),
+      _crc(crc32(0, nullptr, 0)),
+      _size(0),
+      _closed(false) { }
+
+size_t DictzipSink::bufferSize() const {
+    // up to a chunk stays behind in the buffer after a submit
+    return _batches.current().data.size() - chunkLength;
+}
+
+char* DictzipSink::reserve(size_t size) {
+    if (size > _batches.current().data.size() - _batches.current().size) {
+        submit(false);
+    }
+    auto& filling = _batches.current();
+    return &filling.data[filling.size];
+}
+
+void DictzipSink::commit(size_t size) {
+    _batches.current().size += size;
+    _size += size;
+}
+
+void DictzipSink::submit(bool last) {
+    auto writeOut = [this](Batch& batch) { writeChunks(batch); };
+    Batch& next = _batches.wait(writeOut);
+    Batch& full = _batches.current();
+    // the last full chunk is held back until it's known whether more data
+    // follows, as only the final chunk finishes the deflate stream
+    size_t count = last ? std::max<size_t>(1, (full.size + chunkLength - 1) / chunkLength)
+                        : (full.size - 1) / chunkLength;
+    size_t taken = last ? full.size : count * chunkLength;
+    next.size = full.size - taken;
+    memcpy(next.data.data(), full.data.data() + taken, next.size);
+    full.size = taken;
+    full.last = last;
+    full.chunks.assign(count, {});
+    full.crcs.assign(count, 0);
+    for (size_t i = 0; i < count; ++i) {
+        _batches.run([this, &full, i] { compress(full, i); });
+    }
+    _batches.next(writeOut);
+}
+
+void DictzipSink::writeChunks(Batch& batch) {
+    if (_sizes.size() + batch.chunks.size() > maxChunks)
+        throw std::runtime_error("the output is too large for dictzip");
+    bool first = _sizes.empty();
+    for (size_t i = 0; i < batch.chunks.size(); ++i) {
+        _sizes.push_back(batch.chunks[i].size());
+        size_t length = std::min<size_t>(chunkLength, batch.size - i * chunkLength);
+        _crc = crc32_combine(_crc, batch.crcs[i], length);
+    }
+    if (first) {
+        // the sizes are all known when the first batch is also the last
+        if (batch.last) {
+            auto exact = header(0);
+            _out->write(exact.data(), exact.size());
+        } else {
+            std::vector<char> placeholder(maxHeaderSize);
+            _out->write(placeholder.data(), placeholder.size());
+            _headerReserved = true;
+        }
+    }
+    for (auto& chunk : batch.chunks) {
+        _out->write(chunk.data(), chunk.size());
+        std::vector<char>().swap(chunk);
+    }
+}
+
+void DictzipSink::compress(Batch& batch, size_t index) {
+    size_t begin = index * chunkLength;
+    size_t length = std::min<size_t>(chunkLength, batch.size - begin);
+    auto input = reinterpret_cast<Bytef*>(batch.data.data() + begin);
+    bool finish = batch.last && index == batch.chunks.size() - 1;
+    z_stream strm = {};
+    if (deflateInit2(&strm, Z_BEST_COMPRESSION, Z_DEFLATED, -15, 9, Z_DEFAULT_STRATEGY) != Z_OK)
+        throw std::runtime_error("zlib init failed");
+    auto& chunk = batch.chunks[index];
+    // room for the flush marker on top of the worst case
+    chunk.resize(deflateBound(&strm, length) + 16);
+    strm.next_in = input;
+    strm.avail_in = length;
+    strm.next_out = reinterpret_cast<Bytef*>(chunk.data());
+    strm.avail_out = chunk.size();
+    int ret = deflate(&strm, finish ? Z_FINISH : Z_FULL_FLUSH);
+    chunk.resize(chunk.size() - strm.avail_out);
+    deflateEnd(&strm);
+    if (ret != (finish ? Z_STREAM_END : Z_OK) || strm.avail_in || chunk.size() > 0xffff)
+        throw std::runtime_error("deflate failed");
+    batch.crcs[index] = crc32(crc32(0, nullptr, 0), input, length);
+}
+
+// The header of the chunks written so far. A nonzero size pads it to exactly
+// that many bytes with a comment of spaces. The padding can't go into the
+// extra field, as dictzip readers expect the RA subfield alone there.
+std::vector<char> DictzipSink::header(size_t size) const {
+    std::vector<char> header = {0x1f, char(0x8b), Z_DEFLATED, char(size ? 4 | 16 : 4)};
+    putLe(header, 0, 4);
+    header.push_back(2);
+    header.push_back(3);
+    putLe(header, 10 + 2 * _sizes.size(), 2);
+    header.push_back('R');
+    header.push_back('A');
+    putLe(header, 6 + 2 * _sizes.size(), 2);
+    putLe(header, 1, 2);
+    putLe(header, chunkLength, 2);
+    putLe(header, _sizes.size(), 2);
+    for (uint16_t size : _sizes) {
+        putLe(header, size, 2);
+    }
+    if (size) {
+        header.resize(size - 1, ' ');
+        header.push_back(0);
+    }
+    return header;
+}
+
+void DictzipSink::close() {
+    if (_closed)
+        return;
+    _closed = true;
+    submit(true);
+    _batches.wait([this](Batch& batch) { writeChunks(batch); });
+    std::vector<char> trailer;
+    putLe(trailer, _crc, 4);
+    putLe(trailer, static_cast<uint32_t>(_size), 4);
+    _out->write(trailer.data(), trailer.size());
+    if (_headerReserved) {
+        auto padded = header(maxHeaderSize);
+        _out->writeAt(0, padded.data(), padded.size());
+    }
+    _out->close();
+}
+
+DictzipSink::~DictzipSink() { }
+
+}
@@ -0,0 +1,53 @@
+#pragma once
+
+#include "OutputSink.h"
+#include "TaskScheduler.h"
+#include <string>
+#include <vector>
+#include <memory>
+#include <stdint.h>
+
+namespace dictlsd {
+
+// Writes a dictzip file, a gzip file that readers can seek in. The input is
+// cut into chunks that are deflated independently and the compressed size of
+// every chunk is listed in the RA extra field of the gzip header. The chunks
+// of one batch are compressed as tasks of the scheduler while the next batch
+// is being filled. The header comes first but is only known in the end, so
+// unless everything fits in the first batch, room for the largest possible
+// header is left at the start of the file and filled in by close().
+class DictzipSink : public IOutputSink {
+    struct Batch {
+        std::vector<char> data;
+        size_t size = 0;
+        bool last = false;
+        std::vector<std::vector<char>> chunks;
+        std::vector<uint32_t> crcs;
+        Batch() : data(32 * chunkLength) { }
+    };
+    std::unique_ptr<OutputSink> _out;
+    bool _headerReserved;
+    TaskBatches<Batch> _batches;
+    std::vector<uint16_t> _sizes;
+    uint32_t _crc;
+    uint64_t _size;
+    bool _closed;
+    void submit(bool last);
+    void writeChunks(Batch& batch);
+    void compress(Batch& batch, size_t index);
+    std::vector<char> header(size_t size) const;
+public:
+    // the chunk length dictzip uses, its deflated form always fits 16 bits
+    static const unsigned chunkLength = 58315;
+
+    DictzipSink(std::string path, TaskScheduler& scheduler = TaskScheduler::global());
+    DictzipSink(const DictzipSink&) = delete;
+    DictzipSink& operator=(const DictzipSink&) = delete;
+    virtual char* reserve(size_t size) override;
+    virtual void commit(size_t size) override;
+    virtual size_t bufferSize() const override;
+    virtual void close() override;
+    ~DictzipSink();
+};
+
+}
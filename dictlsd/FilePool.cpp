@@ -0,0 +1,86 @@
+#include "FilePool.h"
+
+#include <assert.h>
+
+namespace dictlsd {
+
+FilePool::FilePool(unsigned capacity)
+    : _capacity(capacity)
+{
+    assert(capacity > 0);
+}
+
+std::shared_ptr<UnicodePathFile> FilePool::acquire(std::string const& path) {
+    std::lock_guard<std::mutex> lock(_mutex);
+    auto it = _files.find(path);
+    if (it != end(_files)) {
+        _lru.splice(begin(_lru), _lru, it->second.lru);
+        return it->second.file;
+    }
+    while (_files.size() >= _capacity) {
+        _files.erase(_lru.back());
+        _lru.pop_back();
+    }
+    auto file = std::make_shared<UnicodePathFile>(path, false);
+    _lru.push_front(path);
+    _files[path] = {file, begin(_lru)};
+    return file;
+}
+
+void FilePool::addStream(std::string const& path) {
+    std::lock_guard<std::mutex> lock(_mutex);
+    ++_streams[path];
+}
+
+void FilePool::removeStream(std::string const& path) {
+    std::lock_guard<std::mutex> lock(_mutex);
+    auto streams = _streams.find(path);
+    if (streams == end(_streams) || --streams->second)
+        return;
+    _streams.erase(streams);
+    auto it = _files.find(path);
+    if (it == end(_files))
+        return;
+    _lru.erase(it->second.lru);
+    _files.erase(it);
+}
+
+unsigned FilePool::openCount() {
+    std::lock_guard<std::mutex> lock(_mutex);
+    return _files.size();
+}
+
+PooledFileStream::PooledFileStream(FilePool* pool, std::string path)
+    : _pool(pool), _path(path), _cursor(this)
+{
+    // fail early on a missing file, like FileStream does
+    _pool->acquire(_path);
+    _pool->addStream(_path);
+}
+
+unsigned PooledFileStream::readSome(void* dest, unsigned byteCount) {
+    return _cursor.readSome(dest, byteCount);
+}
+
+void PooledFileStream::seek(uint64_t pos) {
+    _cursor.seek(pos);
+}
+
+uint64_t PooledFileStream::tell() {
+    return _cursor.tell();
+}
+
+unsigned PooledFileStream::readAt(uint64_t pos, void* dest, unsigned byteCount) {
+    auto file = _pool->acquire(_path);
+    return file->readAt(pos, static_cast<char*>(dest), byteCount);
+}
+
+bool PooledFileStream::prefetch(uint64_t pos, unsigned byteCount) {
+    return _pool->acquire(_path)->willNeed(pos, byteCount);
+}
+
+PooledFileStream::~PooledFileStream() {
+    _pool->removeStream(_path);
+}
+
+}
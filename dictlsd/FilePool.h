@@ -0,0 +1,52 @@
+#pragma once
+
+#include "BitStream.h"
+#include "UnicodePathFile.h"
+#include <string>
+#include <list>
+#include <memory>
+#include <mutex>
+#include <unordered_map>
+
+namespace dictlsd {
+
+// A bounded set of open read-only files shared by any number of streams.
+// Files are opened on first use, and the least recently used one is closed
+// when the pool is full. A file that is still being read from stays open
+// until the read finishes. Streams register themselves, and a file is closed
+// early only when the last stream reading it goes away.
+class FilePool {
+    struct Entry {
+        std::shared_ptr<UnicodePathFile> file;
+        std::list<std::string>::iterator lru;
+    };
+    unsigned _capacity;
+    std::mutex _mutex;
+    std::list<std::string> _lru;
+    std::unordered_map<std::string, Entry> _files;
+    std::unordered_map<std::string, unsigned> _streams;
+public:
+    explicit FilePool(unsigned capacity = 64);
+    std::shared_ptr<UnicodePathFile> acquire(std::string const& path);
+    void addStream(std::string const& path);
+    // closes the file if no other stream reads it
+    void removeStream(std::string const& path);
+    unsigned openCount();
+};
+
+// A file stream that only holds a descriptor while the pool lets it.
+class PooledFileStream : public IRandomAccessStream {
+    FilePool* _pool;
+    std::string _path;
+    StreamCursor _cursor;
+public:
+    PooledFileStream(FilePool* pool, std::string path);
+    virtual unsigned readSome(void* dest, unsigned byteCount) override;
+    virtual void seek(uint64_t pos) override;
+    virtual uint64_t tell() override;
+    virtual unsigned readAt(uint64_t pos, void* dest, unsigned byteCount) override;
+    virtual bool prefetch(uint64_t pos, unsigned byteCount) override;
+    ~PooledFileStream();
+};
+
+}
@@ -0,0 +1,100 @@
+#include "FrontCodedHeadings.h"
+
+#include <algorithm>
+#include <stdexcept>
+#include <assert.h>
+
+namespace dictlsd {
+
+void writeVarint(std::vector<uint8_t>& data, unsigned value) {
+    while (value >= 0x80) {
+        data.push_back((value & 0x7F) | 0x80);
+        value >>= 7;
+    }
+    data.push_back(value);
+}
+
+unsigned readVarint(const uint8_t*& ptr) {
+    unsigned value = 0;
+    for (unsigned shift = 0;; shift += 7) {
+        uint8_t byte = *ptr++;
+        value |= (byte & 0x7F) << shift;
+        if (!(byte & 0x80))
+            return value;
+    }
+}
+
+unsigned packChar(CharInfo const& info) {
+    return (info.chr << 2) | (info.sorted << 1) | info.escaped;
+}
+
+CharInfo unpackChar(unsigned packed) {
+    CharInfo info;
+    info.chr = packed >> 2;
+    info.sorted = (packed >> 1) & 1;
+    info.escaped = packed & 1;
+    return info;
+}
+
+FrontCodedHeadings::FrontCodedHeadings(unsigned restartInterval)
+    : _restartInterval(restartInterval), _size(0)
+{
+    if (!_restartInterval)
+        throw std::invalid_argument("restart interval must be positive");
+}
+
+void FrontCodedHeadings::push_back(ArticleHeading const& heading) {
+    CharVec const& chars = heading._chars;
+    size_t shared = 0;
+    if (_size % _restartInterval == 0) {
+        _restarts.push_back(_data.size());
+    } else {
+        size_t maxShared = std::min(chars.size(), _last.size());
+        while (shared < maxShared && chars[shared] == _last[shared])
+            ++shared;
+    }
+    writeVarint(_data, shared);
+    writeVarint(_data, chars.size() - shared);
+    writeVarint(_data, heading._reference);
+    for (size_t i = shared; i < chars.size(); ++i) {
+        writeVarint(_data, packChar(chars[i]));
+    }
+    _last = chars;
+    ++_size;
+}
+
+ArticleHeading FrontCodedHeadings::at(size_t index) const {
+    if (index >= _size)
+        throw std::out_of_range("heading index is out of range");
+    size_t first = index - index % _restartInterval;
+    const uint8_t* ptr = &_data[_restarts[first / _restartInterval]];
+    ArticleHeading heading;
+    for (size_t i = first; i <= index; ++i) {
+        unsigned shared = readVarint(ptr);
+        unsigned postfixLen = readVarint(ptr);
+        heading._reference = readVarint(ptr);
+        assert(shared <= heading._chars.size());
+        heading._chars.resize(shared);
+        for (unsigned j = 0; j < postfixLen; ++j) {
+            heading._chars.push_back(unpackChar(readVarint(ptr)));
+        }
+    }
+    return heading;
+}
+
+size_t FrontCodedHeadings::size() const {
+    return _size;
+}
+
+size_t FrontCodedHeadings::memoryUsage() const {
+    return _data.capacity() + _restarts.capacity() * sizeof(size_t);
+}
+
+void FrontCodedHeadings::shrink_to_fit() {
+    _data.shrink_to_fit();
+    _restarts.shrink_to_fit();
+    _last.clear();
+    _last.shrink_to_fit();
+}
+
+}
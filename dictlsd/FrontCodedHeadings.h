@@ -0,0 +1,29 @@
+#pragma once
+
+#include "ArticleHeading.h"
+#include <vector>
+#include <stdint.h>
+#include <stddef.h>
+
+namespace dictlsd {
+
+// Compact heading storage that keeps the front coding of the LSD pages.
+// Each heading is stored as the number of characters shared with the previous
+// heading plus the remaining postfix. Every restartInterval-th heading is
+// stored in full, so a random access decodes at most restartInterval entries.
+class FrontCodedHeadings {
+    std::vector<uint8_t> _data;
+    std::vector<size_t> _restarts;
+    unsigned _restartInterval;
+    size_t _size;
+    CharVec _last;
+public:
+    explicit FrontCodedHeadings(unsigned restartInterval = 16);
+    void push_back(ArticleHeading const& heading);
+    ArticleHeading at(size_t index) const;
+    size_t size() const;
+    size_t memoryUsage() const;
+    void shrink_to_fit();
+};
+
+}
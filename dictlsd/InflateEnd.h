@@ -0,0 +1,15 @@
+#pragma once
+
+#include <zlib.h>
+
+namespace dictlsd {
+
+// calls inflateEnd when an inflate in progress leaves the scope
+struct InflateEnd {
+    z_stream* strm;
+    ~InflateEnd() {
+        inflateEnd(strm);
+    }
+};
+
+}
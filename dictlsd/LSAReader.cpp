@@ -5,6 +5,10 @@
 #include "BitStream.h"
 #include "tools.h"
 #include "UnicodePathFile.h"
+#include "ArchiveStream.h"
+#include "TaskScheduler.h"
+#include <unordered_map>
+#include <memory>
 #include <stdexcept>
 #include <assert.h>
 #include <boost/filesystem.hpp>
@@ -43,8 +47,10 @@ void LSAReader::collectHeadings() {
     _totalSamples = 0;
     for (size_t i = 0; i < _entriesCount; ++i) {
         std::u16string name = readLSAString(_bstr);
-        unsigned sampleOffset = 0;
         if (i > 0) {
+            // only the low 32 bits of the offset are stored, the full one is
+            // the sum of the preceding sizes
+            uint32_t sampleOffset;
             _bstr->readSome(&sampleOffset, 4);
             uint8_t marker;
             _bstr->readSome(&marker, 1);
@@ -55,8 +61,8 @@ void LSAReader::collectHeadings() {
         }
         unsigned size;
         _bstr->readSome(&size, 4);
+        _entries.push_back({name, _totalSamples, size});
         _totalSamples += size;
-        _entries.push_back({name, sampleOffset, size});
     }
     _oggOffset = _bstr->tell();
 }
@@ -68,32 +74,75 @@ void LSAReader::dump(std::string path,
     _bstr->seek(_oggOffset);
     OggReader oggReader(_bstr);
     //assert(oggReader.totalSamples() == _totalSamples);
-    std::vector<short> samples;
-    std::vector<char> wav;
-    uint64_t curSample = 0;
-    int progress, prevProgress = initialProgress;
-    for (LSAEntry& entry : _entries) {
-        if (curSample != entry.sampleOffset) { // int32 overflow, ignore
-        }
-
-        std::string name = toUtf8(entry.name);
-        boost::algorithm::trim(name);
-
-        oggReader.readSamples(entry.sampleSize, samples);
-        createWav(samples, wav);
+    // the files are written in no particular order, so a name that repeats
+    // is only written for its last entry
+    std::vector<std::string> names(_entries.size());
+    std::unordered_map<std::string, size_t> lastEntries;
+    for (size_t i = 0; i < _entries.size(); ++i) {
+        toUtf8(_entries[i].name, names[i]);
+        boost::algorithm::trim(names[i]);
+        lastEntries[names[i]] = i;
+    }
 
-        if (samples.size() != entry.sampleSize)
+    uint64_t written = 0;
+    int progress, prevProgress = initialProgress;
+    decodeAndWrite(_entries.size(), [&](size_t i, std::vector<short>& samples) {
+        oggReader.readSamples(_entries[i].sampleSize, samples);
+        if (samples.size() != _entries[i].sampleSize)
             throw std::runtime_error("error reading LSA");
-
-        UnicodePathFile file(path + "/" + name, true);
+        return lastEntries[names[i]] == i;
+    }, [&](size_t i, std::vector<short> const& samples) {
+        std::vector<char> wav;
+        createWav(samples, wav);
+        UnicodePathFile file(path + "/" + names[i], true);
         file.write(wav.data(), wav.size());
+    }, [&](uint64_t samples) {
+        written += samples;
+        if (_totalSamples) {
+            progress = (100 - initialProgress) * written / _totalSamples + initialProgress;
+            if (progress != prevProgress) {
+                log(prevProgress = progress);
+            }
+        }
+    });
+}
 
-        progress = (100 - initialProgress) * curSample / _totalSamples + initialProgress;
-        if (progress != prevProgress) {
-            log(prevProgress = progress);
+void decodeAndWrite(size_t count,
+                    std::function<bool(size_t i, std::vector<short>& samples)> decode,
+                    std::function<void(size_t i, std::vector<short> const& samples)> write,
+                    std::function<void(uint64_t samples)> written,
+                    TaskScheduler& scheduler)
+{
+    // Vorbis decoding stays on this thread, the samples of every entry are
+    // passed on to a task of the scheduler that encodes and writes the wav.
+    struct Batch {
+        std::vector<std::vector<short>> samples;
+        uint64_t sampleCount = 0;
+    };
+    const size_t batchSize = 4 * scheduler.threads();
+    TaskBatches<Batch> batches(scheduler);
+    auto finish = [&](Batch& batch) {
+        if (batch.sampleCount) {
+            written(batch.sampleCount);
+        }
+        batch.sampleCount = 0;
+    };
+    for (size_t first = 0; first < count; first += batchSize) {
+        Batch& batch = batches.current();
+        batch.samples.resize(std::min(batchSize, count - first));
+        for (size_t i = first; i < first + batch.samples.size(); ++i) {
+            auto samples = &batch.samples[i - first];
+            bool keep = decode(i, *samples);
+            batch.sampleCount += samples->size();
+            if (!keep)
+                continue;
+            batches.run([&, i, samples] {
+                write(i, *samples);
+            });
         }
-        curSample += samples.size();
+        batches.next(finish);
     }
+    batches.wait(finish);
 }
 
 unsigned LSAReader::entriesCount() const {
@@ -101,10 +150,10 @@ unsigned LSAReader::entriesCount() const {
 }
 
 void decodeLSA(std::string lsaPath, std::string outputPath, std::function<void(int)> log) {
-    fs::path lsaOutputDir = outputPath / fs::path(lsaPath).filename().replace_extension("extracted");
+    fs::path lsaOutputDir = outputPath / fs::path(dictionaryFileName(lsaPath)).replace_extension("extracted");
     fs::create_directories(lsaOutputDir);
-    FileStream bstr(lsaPath);
-    LSAReader reader(&bstr);
+    auto stream = openDictionaryStream(lsaPath);
+    LSAReader reader(stream.get());
     log(1);
     reader.collectHeadings();
     log(5);
@@ -1,6 +1,7 @@
 #pragma once
 
 #include "BitStream.h"
+#include "TaskScheduler.h"
 #include <string>
 #include <vector>
 #include <functional>
@@ -9,7 +10,7 @@ namespace dictlsd {
 
 struct LSAEntry {
     std::u16string name;
-    unsigned sampleOffset; // easily overflowed for very big archives
+    uint64_t sampleOffset;
     unsigned sampleSize;
 };
 
@@ -17,8 +18,8 @@ class LSAReader {
     IRandomAccessStream* _bstr;
     std::vector<LSAEntry> _entries;
     unsigned _entriesCount;
-    unsigned long long _totalSamples;
-    unsigned _oggOffset;
+    uint64_t _totalSamples;
+    uint64_t _oggOffset;
 public:
     LSAReader(IRandomAccessStream* bstr);
     void collectHeadings();
@@ -28,6 +29,18 @@ public:
     unsigned entriesCount() const;
 };
 
+// The pipeline of LSAReader::dump. decode(i, samples) runs for every entry
+// in order on the calling thread and returns whether the entry is to be
+// written; write(i, samples) then runs as a task of the scheduler. Decoding
+// runs at most two batches ahead of the writes. written(samples) reports the
+// samples of every batch once it is out. The first error of either kind is
+// rethrown, and the writes that haven't started by then are dropped.
+void decodeAndWrite(size_t count,
+                    std::function<bool(size_t i, std::vector<short>& samples)> decode,
+                    std::function<void(size_t i, std::vector<short> const& samples)> write,
+                    std::function<void(uint64_t samples)> written,
+                    TaskScheduler& scheduler = TaskScheduler::global());
+
 void decodeLSA(std::string lsaPath, std::string outputPath, std::function<void(int)> log);
 
 }
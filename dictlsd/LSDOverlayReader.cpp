@@ -3,68 +3,77 @@
 #include "BitStream.h"
 #include "DictionaryReader.h"
 #include "tools.h"
+#include "InflateEnd.h"
 
 #include <zlib.h>
+#include <algorithm>
 #include <stdexcept>
+#include <cstring>
 
 namespace dictlsd {
 
-void zlibInflate(std::vector<uint8_t>& res,
-                 std::vector<uint8_t> const& buf,
-                 unsigned inflatedSize)
-{
-    res.resize(inflatedSize);
+const unsigned inflateWindow = 1 << 16;
 
-    z_stream strm;
-    strm.zalloc = Z_NULL;
-    strm.zfree = Z_NULL;
-    strm.opaque = Z_NULL;
-    strm.avail_in = 0;
-    strm.next_in = Z_NULL;
-    int ret = inflateInit(&strm);
-    if (ret != Z_OK)
+// Inflates a zlib stream that read() supplies in pieces of up to
+// inflateWindow bytes and passes the output to sink in pieces of the same
+// size. Returns the number of compressed bytes up to the end of the stream.
+// A stream that runs out before its end or inflates to anything but
+// inflatedSize bytes is rejected.
+uint64_t inflatePieces(std::function<unsigned(uint8_t* buf, unsigned size)> read,
+                       unsigned inflatedSize,
+                       OverlaySink const& sink)
+{
+    z_stream strm = {};
+    if (inflateInit(&strm) != Z_OK)
         throw std::runtime_error("zlib init failed");
-
-    strm.avail_in = buf.size();
-    strm.next_in = (Bytef*)buf.data();
-    strm.avail_out = inflatedSize;
-    strm.next_out = (Bytef*)&res[0];
-
-    ret = inflate(&strm, Z_FINISH);
-    assert(ret != Z_STREAM_ERROR);  /* state not clobbered */
-    switch (ret) {
-    case Z_NEED_DICT:
-        ret = Z_DATA_ERROR;     /* and fall through */
-    case Z_DATA_ERROR:
-    case Z_MEM_ERROR:
-        (void)inflateEnd(&strm);
-        throw std::runtime_error("zlib memory error");
-    }
-    if (ret != Z_STREAM_END)
-        std::runtime_error("zlib inflate failed");
-    inflateEnd(&strm);
+    InflateEnd guard{&strm};
+    std::vector<uint8_t> input(inflateWindow), output(inflateWindow);
+    int ret;
+    do {
+        if (!strm.avail_in) {
+            strm.next_in = input.data();
+            strm.avail_in = read(input.data(), input.size());
+        }
+        strm.next_out = output.data();
+        strm.avail_out = output.size();
+        ret = inflate(&strm, Z_NO_FLUSH);
+        if (ret == Z_NEED_DICT || ret == Z_DATA_ERROR || ret == Z_MEM_ERROR)
+            throw std::runtime_error("corrupted overlay entry");
+        // no progress is possible only when the input has run out
+        if (ret == Z_BUF_ERROR)
+            throw std::runtime_error("truncated overlay entry");
+        if (strm.total_out > inflatedSize)
+            throw std::runtime_error("corrupted overlay entry");
+        sink(output.data(), output.size() - strm.avail_out);
+    } while (ret != Z_STREAM_END);
+    if (strm.total_out != inflatedSize)
+        throw std::runtime_error("corrupted overlay entry");
+    return strm.total_in;
 }
 
-LSDOverlayReader::LSDOverlayReader(IBitStream* bstr,
-                                   DictionaryReader *dictionaryReader)
-    : _reader(dictionaryReader), _bstr(bstr)
+LSDOverlayReader::LSDOverlayReader(DictionaryReader *dictionaryReader)
+    : _reader(dictionaryReader)
 { }
 
-std::vector<OverlayHeading> LSDOverlayReader::readHeadings() {
+std::vector<OverlayHeading> LSDOverlayReader::readHeadings(IBitStream& bstr) const {
     auto offset = _reader->overlayDataOffset();
     if (offset == -1u)
         return {};
-    _bstr->seek(_reader->overlayHeadingsOffset());
-    _bstr->readSome(&_entriesCount, 4);
+    bstr.seek(_reader->overlayHeadingsOffset());
+    unsigned entriesCount;
+    bstr.readSome(&entriesCount, 4);
     std::vector<OverlayHeading> entries;
-    for (unsigned i = 0; i < _entriesCount; ++i) {
+    for (unsigned i = 0; i < entriesCount; ++i) {
         OverlayHeading entry;
-        unsigned nameLen = _bstr->read(8);
-        entry.name = readUnicodeString(_bstr, nameLen, false);
-        _bstr->readSome(&entry.offset, 4);
-        _bstr->readSome(&entry.unk2, 4);
-        _bstr->readSome(&entry.inflatedSize, 4);
-        _bstr->readSome(&entry.streamSize, 4);
+        unsigned nameLen = bstr.read(8);
+        entry.name.resize(nameLen);
+        bstr.readSome(&entry.name[0], 2 * nameLen);
+        uint32_t fields[4];
+        bstr.readSome(fields, sizeof(fields));
+        entry.offset = fields[0];
+        entry.unk2 = fields[1];
+        entry.inflatedSize = fields[2];
+        entry.streamSize = fields[3];
         if (entry.inflatedSize) {
             entries.push_back(entry);
         }
@@ -72,13 +81,73 @@ std::vector<OverlayHeading> LSDOverlayReader::readHeadings() {
     return entries;
 }
 
-std::vector<uint8_t> LSDOverlayReader::readEntry(OverlayHeading const& heading) {
-    _bstr->seek(heading.offset + _reader->overlayDataOffset());
-    std::vector<uint8_t> slice(heading.streamSize);
-    _bstr->readSome(&slice[0], heading.streamSize);
+void LSDOverlayReader::inflateEntry(IBitStream& bstr,
+                                    OverlayHeading const& heading,
+                                    OverlaySink const& sink) const
+{
+    bstr.seek(uint64_t(heading.offset) + _reader->overlayDataOffset());
+    unsigned left = heading.streamSize;
+    inflatePieces([&](uint8_t* buf, unsigned size) {
+        size = std::min(size, left);
+        if (bstr.readSome(buf, size) != size)
+            throw std::runtime_error("truncated overlay entry");
+        left -= size;
+        return size;
+    }, heading.inflatedSize, sink);
+}
+
+std::vector<uint8_t> LSDOverlayReader::readEntry(IBitStream& bstr, OverlayHeading const& heading) const {
     std::vector<uint8_t> res;
-    zlibInflate(res, slice, heading.inflatedSize);
+    res.reserve(heading.inflatedSize);
+    inflateEntry(bstr, heading, [&](const uint8_t* data, size_t size) {
+        res.insert(end(res), data, data + size);
+    });
     return res;
 }
 
+std::vector<uint8_t> LSDOverlayReader::readStream(IBitStream& bstr, OverlayHeading const& heading) const {
+    bstr.seek(uint64_t(heading.offset) + _reader->overlayDataOffset());
+    std::vector<uint8_t> stream(heading.streamSize);
+    if (bstr.readSome(stream.data(), stream.size()) != stream.size())
+        throw std::runtime_error("truncated overlay entry");
+    return stream;
+}
+
+DeflatedOverlayEntry LSDOverlayReader::readDeflatedEntry(IBitStream& bstr, OverlayHeading const& heading) const {
+    return deflatedEntry(heading, readStream(bstr, heading));
+}
+
+void LSDOverlayReader::inflateStream(OverlayHeading const& heading,
+                                     std::vector<uint8_t> const& stream,
+                                     OverlaySink const& sink) const
+{
+    size_t pos = 0;
+    inflatePieces([&](uint8_t* buf, unsigned size) {
+        size = std::min<size_t>(size, stream.size() - pos);
+        memcpy(buf, stream.data() + pos, size);
+        pos += size;
+        return size;
+    }, heading.inflatedSize, sink);
+}
+
+DeflatedOverlayEntry LSDOverlayReader::deflatedEntry(OverlayHeading const& heading, std::vector<uint8_t> stream) const {
+    DeflatedOverlayEntry entry{std::move(stream), 0, heading.inflatedSize};
+    auto& data = entry.data;
+    size_t pos = 0;
+    uint32_t crc = crc32(0, nullptr, 0);
+    auto in = inflatePieces([&](uint8_t* buf, unsigned size) {
+        size = std::min<size_t>(size, data.size() - pos);
+        memcpy(buf, data.data() + pos, size);
+        pos += size;
+        return size;
+    }, heading.inflatedSize, [&](const uint8_t* piece, size_t size) {
+        crc = crc32(crc, piece, size);
+    });
+    // drop the zlib header and the adler-32 trailer around the deflate data
+    data.resize(in - 4);
+    data.erase(begin(data), begin(data) + 2);
+    entry.crc32 = crc;
+    return entry;
+}
+
 }
@@ -9,13 +9,21 @@ namespace dictlsd {
 class DictionaryReader;
 class LSDOverlayReader {
     DictionaryReader* _reader;
-    unsigned _entriesCount;
-    IBitStream* _bstr;
 public:
-    LSDOverlayReader(IBitStream* bstr,
-                     DictionaryReader* dictionaryReader);
-    std::vector<OverlayHeading> readHeadings();
-    std::vector<uint8_t> readEntry(OverlayHeading const& heading);
+    LSDOverlayReader(DictionaryReader* dictionaryReader);
+    std::vector<OverlayHeading> readHeadings(IBitStream& bstr) const;
+    // inflates the entry in fixed-size pieces and hands them to sink in order
+    void inflateEntry(IBitStream& bstr, OverlayHeading const& heading, OverlaySink const& sink) const;
+    std::vector<uint8_t> readEntry(IBitStream& bstr, OverlayHeading const& heading) const;
+    // the zlib stream of the entry as it is stored
+    std::vector<uint8_t> readStream(IBitStream& bstr, OverlayHeading const& heading) const;
+    // the entry is inflated in small pieces only to compute the CRC-32
+    DeflatedOverlayEntry readDeflatedEntry(IBitStream& bstr, OverlayHeading const& heading) const;
+    // the same for a stream that readStream has returned
+    void inflateStream(OverlayHeading const& heading,
+                       std::vector<uint8_t> const& stream,
+                       OverlaySink const& sink) const;
+    DeflatedOverlayEntry deflatedEntry(OverlayHeading const& heading, std::vector<uint8_t> stream) const;
 };
 
 }
@@ -9,8 +9,9 @@ namespace dictlsd {
 
 size_t read_func(void *ptr, size_t size, size_t nmemb, void *datasource) {
     auto bstr = static_cast<IRandomAccessStream*>(datasource);
-    bstr->readSome(ptr, size * nmemb);
-    return nmemb;
+    if (!size)
+        return 0;
+    return bstr->readSome(ptr, size * nmemb) / size;
 }
 
 ov_callbacks callbacks {
@@ -31,13 +32,14 @@ OggReader::OggReader(IRandomAccessStream *bstr)
 }
 
 const unsigned BUFF_SIZE = 4096;
-short buffer[BUFF_SIZE / 2];
 
-void OggReader::readSamples(unsigned count, std::vector<short> &vec) {
+void OggReader::readSamples(uint64_t count, std::vector<short> &vec) {
+    // several archives may be decoded at once, each into a buffer of its own
+    short buffer[BUFF_SIZE / 2];
     vec.clear();
     count *= 2; // samples -> bytes
     while (count) {
-        unsigned toRead = std::min(count, BUFF_SIZE);
+        unsigned toRead = std::min<uint64_t>(count, BUFF_SIZE);
         long bytesRead = ov_read(_vfile.get(), (char*)buffer, toRead, 0, 2, 1, &_vbitstream);
         if (bytesRead == OV_HOLE ||
             bytesRead == OV_EBADLINK ||
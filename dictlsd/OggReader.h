@@ -14,7 +14,7 @@ class OggReader {
 public:
     OggReader(IRandomAccessStream* bstr);
     // little endian signed mono
-    void readSamples(unsigned count, std::vector<short>& vec);
+    void readSamples(uint64_t count, std::vector<short>& vec);
     uint64_t totalSamples();
     ~OggReader();
 };
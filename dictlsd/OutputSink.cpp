@@ -0,0 +1,132 @@
+#include "OutputSink.h"
+
+#include <stdexcept>
+#include <cstring>
+#include <assert.h>
+
+#ifndef __MINGW32__
+#include <sys/uio.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <errno.h>
+#endif
+
+namespace dictlsd {
+
+#ifndef __MINGW32__
+void writeAll(int fd, iovec* iov, int count) {
+    while (count) {
+        auto written = ::writev(fd, iov, count);
+        if (written < 0) {
+            if (errno == EINTR)
+                continue;
+            throw std::runtime_error("can't write to file");
+        }
+        while (count && static_cast<size_t>(written) >= iov->iov_len) {
+            written -= iov->iov_len;
+            ++iov;
+            --count;
+        }
+        if (count) {
+            iov->iov_base = static_cast<char*>(iov->iov_base) + written;
+            iov->iov_len -= written;
+        }
+    }
+}
+#endif
+
+OutputSink::OutputSink(std::string path, size_t bufferSize)
+    : _file(path, true), _buf(bufferSize), _used(0), _written(0), _preallocated(0) { }
+
+void OutputSink::preallocate(uint64_t size) {
+#ifdef __linux__
+    if (size > _preallocated && !fallocate(_file.fd(), FALLOC_FL_KEEP_SIZE, 0, size)) {
+        _preallocated = size;
+    }
+#else
+    (void)size;
+#endif
+}
+
+void OutputSink::writeOut(const char* data, size_t size) {
+#ifdef __MINGW32__
+    _file.write(_buf.data(), _used);
+    _file.write(data, size);
+#else
+    iovec iov[2] = {{_buf.data(), _used}, {const_cast<char*>(data), size}};
+    writeAll(_file.fd(), iov, 2);
+#endif
+    _written += _used + size;
+    _used = 0;
+}
+
+void OutputSink::write(const void* data, size_t size) {
+    auto bytes = static_cast<const char*>(data);
+    if (size <= _buf.size() - _used) {
+        memcpy(&_buf[_used], bytes, size);
+        _used += size;
+        return;
+    }
+    if (size >= _buf.size()) {
+        writeOut(bytes, size);
+        return;
+    }
+    flush();
+    memcpy(&_buf[0], bytes, size);
+    _used = size;
+}
+
+void OutputSink::writeAt(uint64_t pos, const void* data, size_t size) {
+    assert(pos + size <= this->size());
+    flush();
+    auto bytes = static_cast<const char*>(data);
+#ifdef __MINGW32__
+    _file.seek(pos);
+    _file.write(bytes, size);
+    _file.seek(_written);
+#else
+    while (size) {
+        auto written = ::pwrite(_file.fd(), bytes, size, pos);
+        if (written < 0) {
+            if (errno == EINTR)
+                continue;
+            throw std::runtime_error("can't write to file");
+        }
+        bytes += written;
+        pos += written;
+        size -= written;
+    }
+#endif
+}
+
+char* OutputSink::reserve(size_t size) {
+    assert(size <= _buf.size());
+    if (size > _buf.size() - _used) {
+        flush();
+    }
+    return &_buf[_used];
+}
+
+void OutputSink::flush() {
+    if (_used) {
+        writeOut(nullptr, 0);
+    }
+}
+
+void OutputSink::close() {
+    flush();
+#ifndef __MINGW32__
+    if (_preallocated > _written && ftruncate(_file.fd(), _written)) {
+        throw std::runtime_error("can't write to file");
+    }
+    _preallocated = 0;
+#endif
+}
+
+OutputSink::~OutputSink() {
+    try {
+        close();
+    } catch (...) { }
+}
+
+}
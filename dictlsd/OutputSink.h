@@ -0,0 +1,68 @@
+#pragma once
+
+#include "UnicodePathFile.h"
+#include <string>
+#include <vector>
+#include <stdint.h>
+
+namespace dictlsd {
+
+// Sequential output written through a buffer the caller fills in place.
+class IOutputSink {
+public:
+    // returns room for at least size bytes at the end of the buffer, which
+    // commit() then appends; size must not exceed bufferSize()
+    virtual char* reserve(size_t size) = 0;
+    virtual void commit(size_t size) = 0;
+    virtual size_t bufferSize() const = 0;
+    virtual void close() = 0;
+    virtual ~IOutputSink() = default;
+};
+
+// Sequential output to a new file through a large buffer. Small writes only
+// copy into the buffer, which goes out in a single write call when it fills
+// up. Writes larger than the buffer go out in one writev together with what
+// is already buffered.
+class OutputSink : public IOutputSink {
+    UnicodePathFile _file;
+    std::vector<char> _buf;
+    size_t _used;
+    uint64_t _written;
+    uint64_t _preallocated;
+    void writeOut(const char* data, size_t size);
+public:
+    OutputSink(std::string path, size_t bufferSize = 1 << 20);
+    OutputSink(const OutputSink&) = delete;
+    OutputSink& operator=(const OutputSink&) = delete;
+    // asks the file system to reserve space for a file of about this size,
+    // close() trims what is left unused
+    void preallocate(uint64_t size);
+    void write(const void* data, size_t size);
+    // overwrites bytes that were written before, pos + size must not exceed
+    // size()
+    void writeAt(uint64_t pos, const void* data, size_t size);
+    void write(const char16_t* str, size_t length) {
+        write(static_cast<const void*>(str), 2 * length);
+    }
+    void write(std::u16string const& str) {
+        write(str.data(), str.length());
+    }
+    template <size_t N> void write(const char16_t (&literal)[N]) {
+        write(literal, N - 1);
+    }
+    virtual char* reserve(size_t size) override;
+    virtual void commit(size_t size) override {
+        _used += size;
+    }
+    virtual size_t bufferSize() const override {
+        return _buf.size();
+    }
+    uint64_t size() const {
+        return _written + _used;
+    }
+    void flush();
+    virtual void close() override;
+    ~OutputSink();
+};
+
+}
@@ -0,0 +1,210 @@
+#include "TaskScheduler.h"
+
+#include <algorithm>
+
+namespace dictlsd {
+
+struct TaskScheduler::GroupState {
+    TaskScheduler& scheduler;
+    std::mutex mutex;
+    std::deque<std::function<void()>> tasks;
+    // the tasks queued or running
+    size_t pending = 0;
+    std::exception_ptr error;
+    // set by the group's destructor, no more tasks are accepted
+    bool closed = false;
+    // wakes the waiter of the group when a task is added or the last one is
+    // done, the workers sleep on the scheduler's condition instead
+    std::condition_variable changed;
+
+    GroupState(TaskScheduler& scheduler) : scheduler(scheduler) { }
+
+    // drops the tasks that haven't started, returning them so that they are
+    // destroyed outside the lock
+    std::deque<std::function<void()>> dropQueued() {
+        std::deque<std::function<void()>> dropped;
+        dropped.swap(tasks);
+        pending -= dropped.size();
+        return dropped;
+    }
+
+    // runs a queued task, returns false if there is none
+    bool runOne() {
+        std::function<void()> task;
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            if (tasks.empty())
+                return false;
+            task = std::move(tasks.front());
+            tasks.pop_front();
+        }
+        std::exception_ptr taskError;
+        std::deque<std::function<void()>> dropped;
+        try {
+            task();
+        } catch (...) {
+            taskError = std::current_exception();
+        }
+        bool finished;
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            if (taskError && !error) {
+                error = taskError;
+                dropped = dropQueued();
+            }
+            finished = --pending == 0;
+        }
+        if (finished) {
+            changed.notify_all();
+        }
+        return true;
+    }
+};
+
+static unsigned globalThreads = 0;
+// the scheduler and queue of the worker running on this thread
+static thread_local TaskScheduler* currentScheduler = nullptr;
+static thread_local size_t currentQueue = 0;
+
+TaskScheduler::TaskScheduler(unsigned threads)
+    : _queued(0), _nextQueue(0), _stop(false)
+{
+    threads = std::max(1u, threads);
+    for (unsigned i = 0; i < threads; ++i) {
+        _queues.emplace_back(new Queue());
+    }
+    for (unsigned i = 0; i < threads; ++i) {
+        _threads.emplace_back([this, i] { work(i); });
+    }
+}
+
+unsigned TaskScheduler::threads() const {
+    return _threads.size();
+}
+
+void TaskScheduler::notify() {
+    // taking the mutex orders the change with a worker checking for it; any
+    // worker can take any task, so waking one is enough
+    { std::lock_guard<std::mutex> lock(_mutex); }
+    _wake.notify_one();
+}
+
+void TaskScheduler::push(std::shared_ptr<GroupState> group) {
+    size_t index = currentScheduler == this
+        ? currentQueue
+        : _nextQueue++ % _queues.size();
+    {
+        std::lock_guard<std::mutex> lock(_queues[index]->mutex);
+        _queues[index]->tasks.push_back(std::move(group));
+    }
+    ++_queued;
+    notify();
+}
+
+std::shared_ptr<TaskScheduler::GroupState> TaskScheduler::pop(size_t self) {
+    std::shared_ptr<GroupState> group;
+    {
+        auto& own = *_queues[self];
+        std::lock_guard<std::mutex> lock(own.mutex);
+        if (!own.tasks.empty()) {
+            group = std::move(own.tasks.back());
+            own.tasks.pop_back();
+        }
+    }
+    for (size_t i = 1; !group && i < _queues.size(); ++i) {
+        auto& other = *_queues[(self + i) % _queues.size()];
+        std::lock_guard<std::mutex> lock(other.mutex);
+        if (!other.tasks.empty()) {
+            group = std::move(other.tasks.front());
+            other.tasks.pop_front();
+        }
+    }
+    if (group) {
+        --_queued;
+    }
+    return group;
+}
+
+void TaskScheduler::work(size_t self) {
+    currentScheduler = this;
+    currentQueue = self;
+    for (;;) {
+        // the group's task may already have been run by its waiter
+        if (auto group = pop(self)) {
+            group->runOne();
+            continue;
+        }
+        std::unique_lock<std::mutex> lock(_mutex);
+        _wake.wait(lock, [&] { return _stop || _queued > 0; });
+        if (_stop)
+            return;
+    }
+}
+
+TaskScheduler::~TaskScheduler() {
+    {
+        std::lock_guard<std::mutex> lock(_mutex);
+        _stop = true;
+    }
+    _wake.notify_all();
+    for (auto& thread : _threads) {
+        thread.join();
+    }
+}
+
+TaskScheduler& TaskScheduler::global() {
+    static TaskScheduler scheduler(globalThreads ? globalThreads : std::thread::hardware_concurrency());
+    return scheduler;
+}
+
+void TaskScheduler::setGlobalThreads(unsigned threads) {
+    globalThreads = threads;
+}
+
+TaskGroup::TaskGroup(TaskScheduler& scheduler)
+    : _state(std::make_shared<TaskScheduler::GroupState>(scheduler)) { }
+
+void TaskGroup::run(std::function<void()> task) {
+    {
+        std::lock_guard<std::mutex> lock(_state->mutex);
+        if (_state->error || _state->closed)
+            return;
+        _state->tasks.push_back(std::move(task));
+        ++_state->pending;
+    }
+    _state->changed.notify_one();
+    _state->scheduler.push(_state);
+}
+
+void TaskGroup::wait() {
+    for (;;) {
+        if (_state->runOne())
+            continue;
+        std::unique_lock<std::mutex> lock(_state->mutex);
+        _state->changed.wait(lock, [&] {
+            return _state->pending == 0 || !_state->tasks.empty();
+        });
+        if (_state->pending == 0)
+            break;
+    }
+    std::lock_guard<std::mutex> lock(_state->mutex);
+    if (_state->error) {
+        auto error = _state->error;
+        _state->error = nullptr;
+        std::rethrow_exception(error);
+    }
+}
+
+TaskGroup::~TaskGroup() {
+    std::deque<std::function<void()>> dropped;
+    {
+        std::lock_guard<std::mutex> lock(_state->mutex);
+        _state->closed = true;
+        dropped = _state->dropQueued();
+    }
+    try {
+        wait();
+    } catch (...) { }
+}
+
+}
@@ -0,0 +1,134 @@
+#pragma once
+
+#include <functional>
+#include <memory>
+#include <vector>
+#include <deque>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <atomic>
+#include <exception>
+
+namespace dictlsd {
+
+// A pool of worker threads shared by all the parallel work of the process,
+// so that several dictionaries and their stages together stay within one
+// thread budget. Every worker has a deque of its own: it takes the newest
+// task it queued itself and, when it runs out, steals the oldest task of
+// another worker. Tasks are submitted through a TaskGroup.
+class TaskScheduler {
+public:
+    struct GroupState;
+private:
+    struct Queue {
+        std::deque<std::shared_ptr<GroupState>> tasks;
+        std::mutex mutex;
+    };
+    std::vector<std::unique_ptr<Queue>> _queues;
+    std::vector<std::thread> _threads;
+    std::atomic<size_t> _queued;
+    std::atomic<unsigned> _nextQueue;
+    std::mutex _mutex;
+    std::condition_variable _wake;
+    bool _stop;
+    void push(std::shared_ptr<GroupState> group);
+    std::shared_ptr<GroupState> pop(size_t self);
+    void work(size_t self);
+    void notify();
+    friend class TaskGroup;
+public:
+    explicit TaskScheduler(unsigned threads);
+    TaskScheduler(const TaskScheduler&) = delete;
+    TaskScheduler& operator=(const TaskScheduler&) = delete;
+    unsigned threads() const;
+    ~TaskScheduler();
+
+    // the scheduler all the conversion stages share, created on first use
+    static TaskScheduler& global();
+    // sets the thread count of the global scheduler, the number of cores by
+    // default; only has an effect before the scheduler is first used
+    static void setGlobalThreads(unsigned threads);
+};
+
+// Tasks that are waited for together. Instead of blocking, wait() runs the
+// queued tasks of its group on the calling thread, so a task can wait for a
+// group of its own without the pool running out of threads. Once a task has
+// thrown, the tasks of the group that haven't started yet are dropped.
+class TaskGroup {
+    std::shared_ptr<TaskScheduler::GroupState> _state;
+public:
+    explicit TaskGroup(TaskScheduler& scheduler = TaskScheduler::global());
+    TaskGroup(const TaskGroup&) = delete;
+    TaskGroup& operator=(const TaskGroup&) = delete;
+    void run(std::function<void()> task);
+    // waits for all the tasks run so far and rethrows the first exception
+    // one of them threw
+    void wait();
+    // drops the tasks that haven't started and waits for the running ones,
+    // ignoring their errors
+    ~TaskGroup();
+};
+
+// Two batches that take turns, which bounds the data in flight: the caller
+// fills the current batch and runs its tasks while the tasks of the batch
+// submitted before are still at work. A batch is waited for and handed to
+// finish on the calling thread before it's filled again, and every batch
+// is submitted with next() once filled. The tasks of a batch never outlive
+// its data.
+template <typename Batch>
+class TaskBatches {
+    struct Slot {
+        Batch batch;
+        bool submitted = false;
+        // destroyed first
+        std::unique_ptr<TaskGroup> tasks;
+    };
+    Slot _slots[2];
+    size_t _current = 0;
+
+    template <typename Finish>
+    Batch& settle(Slot& slot, Finish& finish) {
+        if (slot.submitted) {
+            slot.submitted = false;
+            slot.tasks->wait();
+            finish(slot.batch);
+        }
+        return slot.batch;
+    }
+public:
+    explicit TaskBatches(TaskScheduler& scheduler = TaskScheduler::global()) {
+        for (auto& slot : _slots) {
+            slot.tasks.reset(new TaskGroup(scheduler));
+        }
+    }
+    TaskBatches(const TaskBatches&) = delete;
+    TaskBatches& operator=(const TaskBatches&) = delete;
+
+    Batch& current() {
+        return _slots[_current].batch;
+    }
+    Batch const& current() const {
+        return _slots[_current].batch;
+    }
+    // runs a task of the current batch
+    void run(std::function<void()> task) {
+        _slots[_current].tasks->run(std::move(task));
+    }
+    // waits for the submitted batch and hands it to finish, unless that's
+    // done already, and returns it
+    template <typename Finish>
+    Batch& wait(Finish finish) {
+        return settle(_slots[1 - _current], finish);
+    }
+    // submits the current batch and makes the other one current, waiting
+    // for it first
+    template <typename Finish>
+    void next(Finish finish) {
+        _slots[_current].submitted = true;
+        _current = 1 - _current;
+        settle(_slots[_current], finish);
+    }
+};
+
+}
@@ -1,6 +1,14 @@
 #include "UnicodePathFile.h"
 #include "tools.h"
 
+#include <stdexcept>
+
+#ifndef __MINGW32__
+#include <unistd.h>
+#include <fcntl.h>
+#include <errno.h>
+#endif
+
 using namespace dictlsd;
 
 UnicodePathFile::UnicodePathFile(std::string path, bool write) {
@@ -16,8 +24,8 @@ UnicodePathFile::UnicodePathFile(std::string path, bool write) {
     if (_file == INVALID_HANDLE_VALUE)
         throw std::runtime_error("can't open file " + path);
 #else
-    _file = std::fstream(path, write ? std::ios_base::out : std::ios_base::in);
-    if (!_file.is_open())
+    _file = fopen(path.c_str(), write ? "wb" : "rb");
+    if (!_file)
         throw std::runtime_error("can't open file " + path);
 #endif
 }
@@ -30,7 +38,9 @@ void UnicodePathFile::write(const char *buf, size_t len) {
         throw std::runtime_error("can't write to file");
     }
 #else
-    _file.write(buf, len);
+    if (fwrite(buf, 1, len, _file) != len) {
+        throw std::runtime_error("can't write to file");
+    }
 #endif
 }
 
@@ -43,29 +53,80 @@ size_t UnicodePathFile::read(char *buf, size_t len) {
     }
     return read;
 #else
-    _file.read(buf, len);
-    return _file.gcount();
+    return fread(buf, 1, len, _file);
+#endif
+}
+
+size_t UnicodePathFile::readAt(uint64_t pos, char *buf, size_t len) {
+#ifdef __MINGW32__
+    OVERLAPPED overlapped = {};
+    overlapped.Offset = pos & 0xFFFFFFFF;
+    overlapped.OffsetHigh = pos >> 32;
+    DWORD read;
+    auto code = ReadFile(_file, buf, len, &read, &overlapped);
+    if (!code) {
+        if (GetLastError() == ERROR_HANDLE_EOF)
+            return 0;
+        throw std::runtime_error("can't read file");
+    }
+    return read;
+#else
+    size_t total = 0;
+    while (total < len) {
+        auto bytesRead = pread(fileno(_file), buf + total, len - total, pos + total);
+        if (bytesRead < 0) {
+            if (errno == EINTR)
+                continue;
+            throw std::runtime_error("can't read file");
+        }
+        if (bytesRead == 0)
+            break;
+        total += bytesRead;
+    }
+    return total;
+#endif
+}
+
+bool UnicodePathFile::willNeed(uint64_t pos, size_t len) {
+#if defined(__MINGW32__) || defined(__APPLE__)
+    (void)pos;
+    (void)len;
+    return false;
+#else
+    return posix_fadvise(fileno(_file), pos, len, POSIX_FADV_WILLNEED) == 0;
 #endif
 }
 
-void UnicodePathFile::seek(unsigned pos) {
+#ifndef __MINGW32__
+int UnicodePathFile::fd() const {
+    return fileno(_file);
+}
+#endif
+
+void UnicodePathFile::seek(uint64_t pos) {
 #ifdef __MINGW32__
-    SetFilePointer(_file, pos, NULL, FILE_BEGIN);
+    LARGE_INTEGER distance;
+    distance.QuadPart = pos;
+    SetFilePointerEx(_file, distance, NULL, FILE_BEGIN);
 #else
-    _file.seekg(pos);
+    fseeko(_file, pos, SEEK_SET);
 #endif
 }
 
-size_t UnicodePathFile::tell() {
+uint64_t UnicodePathFile::tell() {
 #ifdef __MINGW32__
-    return SetFilePointer(_file, 0, NULL, FILE_CURRENT);
+    LARGE_INTEGER distance = {}, pos;
+    SetFilePointerEx(_file, distance, &pos, FILE_CURRENT);
+    return pos.QuadPart;
 #else
-    return _file.tellg();
+    return ftello(_file);
 #endif
 }
 
 UnicodePathFile::~UnicodePathFile() {
 #ifdef __MINGW32__
     CloseHandle(_file);
+#else
+    fclose(_file);
 #endif
 }
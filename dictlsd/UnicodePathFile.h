@@ -1,18 +1,19 @@
 #pragma once
 
 #include <string>
+#include <stdint.h>
 
 #ifdef __MINGW32__
 #include <windows.h>
 #else
-#include <fstream>
+#include <stdio.h>
 #endif
 
 class UnicodePathFile {
 #ifdef __MINGW32__
     HANDLE _file = NULL;
 #else
-    std::fstream _file;
+    FILE* _file = nullptr;
 #endif
 
 public:
@@ -21,7 +22,14 @@ public:
     UnicodePathFile(std::string path, bool write);
     void write(const char* buf, size_t len);
     size_t read(char* buf, size_t len);
-    void seek(unsigned pos);
-    size_t tell();
+    // positional read, doesn't use or move the file position
+    size_t readAt(uint64_t pos, char* buf, size_t len);
+    // asks the OS to start reading the range in, returns false if unsupported
+    bool willNeed(uint64_t pos, size_t len);
+#ifndef __MINGW32__
+    int fd() const;
+#endif
+    void seek(uint64_t pos);
+    uint64_t tell();
     ~UnicodePathFile();
 };
@@ -0,0 +1,291 @@
+#include "UringFileStream.h"
+
+#include <stdexcept>
+
+#ifdef LSD2DSL_IO_URING
+#include <linux/io_uring.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+#include <errno.h>
+#include <string.h>
+#include <algorithm>
+#include <exception>
+#endif
+
+namespace dictlsd {
+
+#ifdef LSD2DSL_IO_URING
+
+// The bare minimum of liburing: a submission and a completion ring mapped
+// from the kernel, used by a single thread.
+class UringFileStream::Ring {
+    int _fd;
+    io_uring_params _params;
+    void* _sq = MAP_FAILED;
+    void* _cq = MAP_FAILED;
+    size_t _sqSize;
+    size_t _cqSize;
+    io_uring_sqe* _sqes = static_cast<io_uring_sqe*>(MAP_FAILED);
+    unsigned* _sqTail;
+    unsigned* _sqMask;
+    unsigned* _sqArray;
+    unsigned* _cqHead;
+    unsigned* _cqTail;
+    unsigned* _cqMask;
+    io_uring_cqe* _cqes;
+    unsigned _pending = 0;
+
+    template <typename T> T* at(void* ring, unsigned offset) {
+        return reinterpret_cast<T*>(static_cast<char*>(ring) + offset);
+    }
+
+    void release() {
+        if (_sqes != MAP_FAILED)
+            munmap(_sqes, _params.sq_entries * sizeof(io_uring_sqe));
+        if (_cq != MAP_FAILED && _cq != _sq)
+            munmap(_cq, _cqSize);
+        if (_sq != MAP_FAILED)
+            munmap(_sq, _sqSize);
+        close(_fd);
+    }
+
+public:
+    Ring(unsigned entries) {
+        memset(&_params, 0, sizeof(_params));
+        _fd = syscall(__NR_io_uring_setup, entries, &_params);
+        if (_fd < 0)
+            throw std::runtime_error("can't set up io_uring");
+        // IORING_OP_READ comes with the same kernel as this flag
+        if (!(_params.features & IORING_FEAT_RW_CUR_POS)) {
+            release();
+            throw std::runtime_error("io_uring is too old");
+        }
+        _sqSize = _params.sq_off.array + _params.sq_entries * sizeof(unsigned);
+        _cqSize = _params.cq_off.cqes + _params.cq_entries * sizeof(io_uring_cqe);
+        bool singleMap = _params.features & IORING_FEAT_SINGLE_MMAP;
+        if (singleMap) {
+            _sqSize = _cqSize = std::max(_sqSize, _cqSize);
+        }
+        int prot = PROT_READ | PROT_WRITE;
+        int flags = MAP_SHARED | MAP_POPULATE;
+        _sq = mmap(nullptr, _sqSize, prot, flags, _fd, IORING_OFF_SQ_RING);
+        _cq = singleMap ? _sq : mmap(nullptr, _cqSize, prot, flags, _fd, IORING_OFF_CQ_RING);
+        _sqes = static_cast<io_uring_sqe*>(mmap(
+            nullptr, _params.sq_entries * sizeof(io_uring_sqe), prot, flags, _fd, IORING_OFF_SQES));
+        if (_sq == MAP_FAILED || _cq == MAP_FAILED || _sqes == MAP_FAILED) {
+            release();
+            throw std::runtime_error("can't map io_uring");
+        }
+        _sqTail = at<unsigned>(_sq, _params.sq_off.tail);
+        _sqMask = at<unsigned>(_sq, _params.sq_off.ring_mask);
+        _sqArray = at<unsigned>(_sq, _params.sq_off.array);
+        _cqHead = at<unsigned>(_cq, _params.cq_off.head);
+        _cqTail = at<unsigned>(_cq, _params.cq_off.tail);
+        _cqMask = at<unsigned>(_cq, _params.cq_off.ring_mask);
+        _cqes = at<io_uring_cqe>(_cq, _params.cq_off.cqes);
+    }
+
+    Ring(Ring const&) = delete;
+    Ring& operator=(Ring const&) = delete;
+
+    ~Ring() {
+        release();
+    }
+
+    unsigned capacity() const {
+        return _params.sq_entries;
+    }
+
+    void push(int fd, uint64_t pos, void* dest, unsigned len, uint64_t tag) {
+        unsigned tail = *_sqTail;
+        unsigned index = tail & *_sqMask;
+        io_uring_sqe& sqe = _sqes[index];
+        memset(&sqe, 0, sizeof(sqe));
+        sqe.opcode = IORING_OP_READ;
+        sqe.fd = fd;
+        sqe.off = pos;
+        sqe.addr = reinterpret_cast<uintptr_t>(dest);
+        sqe.len = len;
+        sqe.user_data = tag;
+        _sqArray[index] = index;
+        __atomic_store_n(_sqTail, tail + 1, __ATOMIC_RELEASE);
+        ++_pending;
+    }
+
+    // submits the pushed reads and waits for at least minComplete
+    // completions, returns false if the kernel refuses
+    bool tryEnter(unsigned minComplete) {
+        if (!_pending && !minComplete)
+            return true;
+        for (;;) {
+            unsigned flags = minComplete ? IORING_ENTER_GETEVENTS : 0;
+            long submitted = syscall(__NR_io_uring_enter, _fd, _pending, minComplete, flags, nullptr, 0);
+            if (submitted < 0) {
+                if (errno == EINTR)
+                    continue;
+                return false;
+            }
+            _pending -= submitted;
+            if (!_pending)
+                return true;
+        }
+    }
+
+    void enter(unsigned minComplete) {
+        if (!tryEnter(minComplete))
+            throw std::runtime_error("can't submit to io_uring");
+    }
+
+    template <typename F> void reap(F f) {
+        unsigned head = *_cqHead;
+        unsigned tail = __atomic_load_n(_cqTail, __ATOMIC_ACQUIRE);
+        for (; head != tail; ++head) {
+            io_uring_cqe& cqe = _cqes[head & *_cqMask];
+            f(cqe.user_data, cqe.res);
+        }
+        __atomic_store_n(_cqHead, head, __ATOMIC_RELEASE);
+    }
+};
+
+// the entries of a stream's ring, a batch with more reads refills it as they
+// complete
+const unsigned ringEntries = 64;
+
+void UringFileStream::readWithRing(Ring& ring,
+                                   int fd,
+                                   std::vector<ReadRequest>& requests,
+                                   std::function<void(ReadRequest&)> const& done)
+{
+    size_t next = 0;
+    unsigned inFlight = 0;
+    bool failed = false;
+    std::vector<size_t> resubmit;
+    std::vector<size_t> finished;
+    auto fill = [&] {
+        while (!failed && inFlight < ring.capacity() && (!resubmit.empty() || next < requests.size())) {
+            size_t i;
+            if (!resubmit.empty()) {
+                i = resubmit.back();
+                resubmit.pop_back();
+            } else {
+                i = next++;
+                requests[i].bytesRead = 0;
+            }
+            auto& request = requests[i];
+            ring.push(fd,
+                      request.pos + request.bytesRead,
+                      static_cast<char*>(request.dest) + request.bytesRead,
+                      request.byteCount - request.bytesRead,
+                      i);
+            ++inFlight;
+        }
+    };
+    auto reap = [&] {
+        ring.reap([&](uint64_t tag, int res) {
+            --inFlight;
+            auto& request = requests[tag];
+            if (res == -EINTR || res == -EAGAIN) {
+                resubmit.push_back(tag);
+            } else if (res < 0) {
+                failed = true;
+            } else {
+                request.bytesRead += res;
+                // a short read that isn't at the end of the file
+                if (res > 0 && request.bytesRead < request.byteCount) {
+                    resubmit.push_back(tag);
+                } else {
+                    finished.push_back(tag);
+                }
+            }
+        });
+    };
+    std::exception_ptr error;
+    try {
+        size_t completed = 0;
+        while (completed < requests.size()) {
+            fill();
+            ring.enter(1);
+            reap();
+            if (failed)
+                throw std::runtime_error("can't read file");
+            // keep the ring busy while the callbacks run
+            fill();
+            ring.enter(0);
+            for (size_t i : finished) {
+                done(requests[i]);
+                ++completed;
+            }
+            finished.clear();
+        }
+    } catch (...) {
+        error = std::current_exception();
+    }
+    if (error) {
+        // the kernel still owns the buffers of the reads in flight, they are
+        // waited for unless the ring itself fails
+        failed = true;
+        while (inFlight && ring.tryEnter(1)) {
+            reap();
+        }
+        std::rethrow_exception(error);
+    }
+}
+
+#else
+
+class UringFileStream::Ring { };
+
+#endif
+
+UringFileStream::UringFileStream(std::string path)
+    : FileStream(path), _ringRefused(false) { }
+
+void UringFileStream::readBatch(std::vector<ReadRequest>& requests,
+                                std::function<void(ReadRequest&)> done) {
+#ifdef LSD2DSL_IO_URING
+    std::unique_lock<std::mutex> lock(_ringMutex, std::try_to_lock);
+    if (requests.size() > 1 && lock.owns_lock() && !_ringRefused) {
+        if (!_ring) {
+            // refused for instance past the locked memory limit or by a
+            // seccomp filter, and then not tried again
+            try {
+                _ring.reset(new Ring(ringEntries));
+            } catch (std::runtime_error&) {
+                _ringRefused = true;
+            }
+        }
+        if (_ring) {
+            try {
+                readWithRing(*_ring, _file.fd(), requests, done);
+            } catch (...) {
+                // reads may still be in flight if the ring itself failed
+                _ring.reset();
+                throw;
+            }
+            return;
+        }
+    }
+#endif
+    FileStream::readBatch(requests, done);
+}
+
+UringFileStream::~UringFileStream() { }
+
+bool UringFileStream::supported() {
+#ifdef LSD2DSL_IO_URING
+    static bool available = [] {
+        try {
+            Ring ring(1);
+            return true;
+        } catch (std::runtime_error&) {
+            return false;
+        }
+    }();
+    return available;
+#else
+    return false;
+#endif
+}
+
+}
@@ -0,0 +1,31 @@
+#pragma once
+
+#include "BitStream.h"
+#include <memory>
+#include <mutex>
+
+namespace dictlsd {
+
+// A file stream that puts all the reads of a batch in flight at once through
+// io_uring. Without io_uring support at build time, or if the kernel refuses
+// to set up a ring, batches fall back to one positional read after another.
+// The ring is set up on the first batch and kept for the following ones; a
+// batch that finds it in use by another thread reads positionally as well.
+class UringFileStream : public FileStream {
+    class Ring;
+    std::unique_ptr<Ring> _ring;
+    bool _ringRefused;
+    std::mutex _ringMutex;
+    static void readWithRing(Ring& ring,
+                             int fd,
+                             std::vector<ReadRequest>& requests,
+                             std::function<void(ReadRequest&)> const& done);
+public:
+    UringFileStream(std::string path);
+    virtual void readBatch(std::vector<ReadRequest>& requests,
+                           std::function<void(ReadRequest&)> done) override;
+    ~UringFileStream();
+    static bool supported();
+};
+
+}
@@ -5,53 +5,341 @@
 #include "BitStream.h"
 #include "CachePage.h"
 #include "LSDOverlayReader.h"
+#include "ArchiveStream.h"
 
+#include <zlib.h>
 #include <algorithm>
+#include <stdexcept>
+#include <cstring>
 
 namespace dictlsd {
 
-std::vector<ArticleHeading> collectHeadingFromPage(IBitStream& bstr, DictionaryReader& reader, unsigned pageNumber) {
-    std::vector<ArticleHeading> res;
+void collectHeadingFromPage(IBitStream& bstr,
+                            DictionaryReader& reader,
+                            unsigned pageNumber,
+                            HeadingDecodeArena& arena,
+                            std::vector<ArticleHeading>& headings)
+{
     bstr.seek(reader.header().pagesOffset + 512 * pageNumber);
     CachePage page;
     page.loadHeader(bstr);
     if (page.isLeaf()) {
-        std::u16string prefix;
-        for (size_t idx = 0; idx < page.headingsCount(); ++idx) {
-            ArticleHeading h;
-            h.Load(*reader.decoder(), bstr, prefix);
-            res.push_back(h);
-        }
+        decodeLeafPageBody(bstr, *reader.decoder(), page.headingsCount(), arena, headings);
     }
-    return res;
 }
 
-LSDDictionary::LSDDictionary(IBitStream *bitstream)
-    : _bstr(bitstream)
+// Runs func on the shared stream, or on a private cursor in concurrent mode.
+template <typename F>
+auto withStream(IBitStream* bstr, bool concurrent, F func) {
+    if (!concurrent)
+        return func(*bstr);
+    StreamCursor cursor(bstr);
+    BitStreamAdapter adapter(&cursor);
+    return func(static_cast<IBitStream&>(adapter));
+}
+
+LSDDictionary::LSDDictionary(IBitStream *bitstream, bool concurrent)
+    : _bstr(bitstream), _concurrent(concurrent)
 {
     _reader.reset(new DictionaryReader(_bstr));
-    _overlayReader.reset(new LSDOverlayReader(_bstr, _reader.get()));
+    _overlayReader.reset(new LSDOverlayReader(_reader.get()));
+    if (_concurrent && _reader->supported()) {
+        _reader->loadDecoder();
+    }
+}
+
+bool LSDDictionary::concurrent() const {
+    return _concurrent;
 }
 
 std::vector<ArticleHeading> LSDDictionary::readHeadings() const {
-    std::vector<ArticleHeading> headings;
-    for (size_t i = 0; i < _reader->pagesCount(); ++i) {
-        auto page = collectHeadingFromPage(*_bstr, *_reader, i);
-        copy(begin(page), end(page), back_inserter(headings));
-    }
-    return headings;
+    return withStream(_bstr, _concurrent, [&](IBitStream& bstr) {
+        std::vector<ArticleHeading> headings;
+        headings.reserve(_reader->header().entriesCount);
+        HeadingDecodeArena arena;
+        for (size_t i = 0; i < _reader->pagesCount(); ++i) {
+            collectHeadingFromPage(bstr, *_reader, i, arena, headings);
+        }
+        return headings;
+    });
+}
+
+FrontCodedHeadings LSDDictionary::readFrontCodedHeadings(unsigned restartInterval) const {
+    return withStream(_bstr, _concurrent, [&](IBitStream& bstr) {
+        FrontCodedHeadings headings(restartInterval);
+        HeadingDecodeArena arena;
+        std::vector<ArticleHeading> page;
+        for (size_t i = 0; i < _reader->pagesCount(); ++i) {
+            page.clear();
+            collectHeadingFromPage(bstr, *_reader, i, arena, page);
+            for (auto& heading : page) {
+                headings.push_back(heading);
+            }
+        }
+        headings.shrink_to_fit();
+        return headings;
+    });
+}
+
+void LSDDictionary::foreachPlainHeading(
+        std::function<void(std::u16string const&, unsigned)> func) const
+{
+    withStream(_bstr, _concurrent, [&](IBitStream& bstr) {
+        HeadingDecodeArena arena;
+        std::u16string text;
+        unsigned reference;
+        for (size_t i = 0; i < _reader->pagesCount(); ++i) {
+            bstr.seek(_reader->header().pagesOffset + 512 * i);
+            CachePage page;
+            page.loadHeader(bstr);
+            if (!page.isLeaf())
+                continue;
+            arena.prefix.clear();
+            for (size_t idx = 0; idx < page.headingsCount(); ++idx) {
+                loadPlainHeading(*_reader->decoder(), bstr, arena, text, reference);
+                func(text, reference);
+            }
+        }
+    });
 }
 
 std::u16string LSDDictionary::readArticle(unsigned reference) const {
-    return _reader->decodeArticle(*_bstr, reference);
+    return withStream(_bstr, _concurrent, [&](IBitStream& bstr) {
+        return _reader->decodeArticle(bstr, reference);
+    });
+}
+
+// Serves reads from a chunk of the stream that was read ahead of time. An
+// article that runs past the end of the chunk is read on through a cursor
+// with a buffer of at most the chunk size.
+class ArticleChunkStream : public IRandomAccessStream {
+    IRandomAccessStream* _ras;
+    uint64_t _start;
+    const uint8_t* _data;
+    unsigned _size;
+    unsigned _tailBufferSize;
+    std::unique_ptr<StreamCursor> _tail;
+    uint64_t _pos;
+public:
+    ArticleChunkStream(IRandomAccessStream* ras,
+                       uint64_t start,
+                       const void* data,
+                       unsigned size,
+                       unsigned tailBufferSize)
+        : _ras(ras),
+          _start(start),
+          _data(static_cast<const uint8_t*>(data)),
+          _size(size),
+          _tailBufferSize(tailBufferSize),
+          _pos(start) { }
+
+    virtual unsigned readSome(void* dest, unsigned byteCount) override {
+        auto out = static_cast<uint8_t*>(dest);
+        unsigned total = 0;
+        if (_pos >= _start && _pos < _start + _size) {
+            total = std::min<uint64_t>(byteCount, _start + _size - _pos);
+            memcpy(out, _data + (_pos - _start), total);
+            _pos += total;
+        }
+        if (total < byteCount) {
+            if (!_tail) {
+                _tail.reset(new StreamCursor(_ras, _tailBufferSize));
+            }
+            _tail->seek(_pos);
+            unsigned count = _tail->readSome(out + total, byteCount - total);
+            _pos += count;
+            total += count;
+        }
+        return total;
+    }
+
+    virtual void seek(uint64_t pos) override {
+        _pos = pos;
+    }
+
+    virtual uint64_t tell() override {
+        return _pos;
+    }
+
+    virtual unsigned readAt(uint64_t pos, void* dest, unsigned byteCount) override {
+        return _ras->readAt(pos, dest, byteCount);
+    }
+};
+
+void LSDDictionary::foreachArticle(std::vector<unsigned> const& references,
+                                   std::function<void(unsigned, std::u16string const&)> func,
+                                   unsigned chunkSize) const
+{
+    std::vector<unsigned> sorted(references);
+    std::sort(begin(sorted), end(sorted));
+    sorted.erase(std::unique(begin(sorted), end(sorted)), end(sorted));
+    auto articlesOffset = _reader->header().articlesOffset;
+    auto regionSize = articlesSize();
+    auto decoder = _reader->decoder();
+    // Neighbouring articles are read together in chunks of at most
+    // chunkSize bytes, a few chunks per batch, and each chunk is decoded as
+    // soon as it arrives. The size of an article is only known once it's
+    // decoded, so the chunk is never cut at the next reference.
+    struct Chunk {
+        size_t first;
+        size_t last;
+        std::vector<uint8_t> buffer;
+        std::vector<std::u16string> articles;
+    };
+    const size_t chunksPerBatch = 16;
+    std::vector<Chunk> chunks(chunksPerBatch);
+    std::vector<ReadRequest> requests;
+    size_t i = 0;
+    while (i < sorted.size()) {
+        requests.clear();
+        size_t count = 0;
+        while (i < sorted.size() && count < chunksPerBatch) {
+            auto& chunk = chunks[count++];
+            unsigned start = sorted[i];
+            chunk.first = i;
+            do {
+                ++i;
+            } while (i < sorted.size() && sorted[i] - start < chunkSize);
+            chunk.last = i;
+            chunk.buffer.resize(std::min(chunkSize, std::max(regionSize, start) - start));
+            requests.push_back({articlesOffset + start, chunk.buffer.data(), (unsigned)chunk.buffer.size(), 0});
+        }
+        _bstr->readBatch(requests, [&](ReadRequest& request) {
+            auto& chunk = chunks[&request - &requests[0]];
+            ArticleChunkStream ras(_bstr, request.pos, request.dest, request.bytesRead, chunkSize);
+            BitStreamAdapter bstr(&ras);
+            chunk.articles.resize(chunk.last - chunk.first);
+            for (size_t k = chunk.first; k < chunk.last; ++k) {
+                bstr.seek(articlesOffset + sorted[k]);
+                if (!decoder->DecodeArticle(&bstr, chunk.articles[k - chunk.first]))
+                    throw std::runtime_error("can't decode article");
+            }
+        });
+        for (size_t c = 0; c < count; ++c) {
+            auto& chunk = chunks[c];
+            for (size_t k = chunk.first; k < chunk.last; ++k) {
+                func(sorted[k], chunk.articles[k - chunk.first]);
+            }
+        }
+    }
+}
+
+std::vector<std::u16string> LSDDictionary::readArticles(std::vector<unsigned> const& references) const {
+    std::vector<unsigned> sorted;
+    std::vector<std::u16string> decoded;
+    foreachArticle(references, [&](unsigned reference, std::u16string const& article) {
+        sorted.push_back(reference);
+        decoded.push_back(article);
+    });
+    std::vector<std::u16string> articles(references.size());
+    for (size_t idx = 0; idx < references.size(); ++idx) {
+        auto it = std::lower_bound(begin(sorted), end(sorted), references[idx]);
+        articles[idx] = decoded[it - begin(sorted)];
+    }
+    return articles;
+}
+
+void LSDDictionary::prefetchArticle(unsigned reference, unsigned size) const {
+    _bstr->prefetch(_reader->header().articlesOffset + reference, size);
+}
+
+unsigned LSDDictionary::articlesSize() const {
+    auto& header = _reader->header();
+    return header.pagesOffset - header.articlesOffset;
 }
 
 std::vector<OverlayHeading> LSDDictionary::readOverlayHeadings() const {
-    return _overlayReader->readHeadings();
+    return withStream(_bstr, _concurrent, [&](IBitStream& bstr) {
+        return _overlayReader->readHeadings(bstr);
+    });
 }
 
 std::vector<uint8_t> LSDDictionary::readOverlayEntry(OverlayHeading const& heading) const {
-    return _overlayReader->readEntry(heading);
+    return withStream(_bstr, _concurrent, [&](IBitStream& bstr) {
+        return _overlayReader->readEntry(bstr, heading);
+    });
+}
+
+void LSDDictionary::inflateOverlayEntry(OverlayHeading const& heading, OverlaySink const& sink) const {
+    withStream(_bstr, _concurrent, [&](IBitStream& bstr) {
+        _overlayReader->inflateEntry(bstr, heading, sink);
+    });
+}
+
+std::vector<uint8_t> LSDDictionary::readOverlayStream(OverlayHeading const& heading) const {
+    return withStream(_bstr, _concurrent, [&](IBitStream& bstr) {
+        return _overlayReader->readStream(bstr, heading);
+    });
+}
+
+DeflatedOverlayEntry LSDDictionary::readDeflatedOverlayEntry(OverlayHeading const& heading) const {
+    return withStream(_bstr, _concurrent, [&](IBitStream& bstr) {
+        return _overlayReader->readDeflatedEntry(bstr, heading);
+    });
+}
+
+void LSDDictionary::inflateOverlayStream(OverlayHeading const& heading,
+                                         std::vector<uint8_t> const& stream,
+                                         OverlaySink const& sink) const
+{
+    _overlayReader->inflateStream(heading, stream, sink);
+}
+
+DeflatedOverlayEntry LSDDictionary::deflatedOverlayEntry(OverlayHeading const& heading,
+                                                         std::vector<uint8_t> stream) const
+{
+    return _overlayReader->deflatedEntry(heading, std::move(stream));
+}
+
+OverlayHeading const* LSDDictionary::findOverlayEntry(std::u16string const& name) const {
+    std::call_once(_overlayIndexBuilt, [&] {
+        for (auto& heading : readOverlayHeadings()) {
+            _overlayIndex.emplace(heading.name, heading);
+        }
+    });
+    auto it = _overlayIndex.find(name);
+    return it == end(_overlayIndex) ? nullptr : &it->second;
+}
+
+// Positional reads of a stream owned by someone else.
+class BorrowedStream : public IRandomAccessStream {
+    IRandomAccessStream* _ras;
+    StreamCursor _cursor;
+public:
+    BorrowedStream(IRandomAccessStream* ras) : _ras(ras), _cursor(this) { }
+
+    virtual unsigned readSome(void* dest, unsigned byteCount) override {
+        return _cursor.readSome(dest, byteCount);
+    }
+
+    virtual void seek(uint64_t pos) override {
+        _cursor.seek(pos);
+    }
+
+    virtual uint64_t tell() override {
+        return _cursor.tell();
+    }
+
+    virtual unsigned readAt(uint64_t pos, void* dest, unsigned byteCount) override {
+        return _ras->readAt(pos, dest, byteCount);
+    }
+};
+
+std::unique_ptr<IRandomAccessStream> LSDDictionary::openOverlayEntry(std::u16string const& name) const {
+    auto heading = findOverlayEntry(name);
+    if (!heading)
+        return nullptr;
+    // the entry is a zlib stream, the deflate data starts after its header
+    uint64_t offset = uint64_t(heading->offset) + _reader->overlayDataOffset();
+    uint8_t header[2];
+    if (_bstr->readAt(offset, header, 2) != 2)
+        throw std::runtime_error("truncated overlay entry");
+    if ((header[0] & 0x0f) != Z_DEFLATED || (header[1] & 0x20) || (header[0] << 8 | header[1]) % 31)
+        throw std::runtime_error("corrupted overlay entry");
+    return std::unique_ptr<IRandomAccessStream>(
+        new InflateStream(std::unique_ptr<IRandomAccessStream>(new BorrowedStream(_bstr)),
+                          offset + 2,
+                          DeflateFormat::Raw));
 }
 
 bool LSDDictionary::supported() const {
@@ -63,7 +351,9 @@ std::u16string LSDDictionary::name() const {
 }
 
 std::u16string LSDDictionary::annotation() const {
-    return _reader->annotation();
+    return withStream(_bstr, _concurrent, [&](IBitStream& bstr) {
+        return _reader->annotation(bstr);
+    });
 }
 
 std::vector<unsigned char> const& LSDDictionary::icon() const {
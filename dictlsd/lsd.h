@@ -2,9 +2,13 @@
 
 #include "BitStream.h"
 #include "ArticleHeading.h"
+#include "FrontCodedHeadings.h"
 #include <string>
 #include <vector>
 #include <memory>
+#include <functional>
+#include <unordered_map>
+#include <mutex>
 
 namespace dictlsd {
 
@@ -35,22 +39,73 @@ struct OverlayHeading {
     uint32_t streamSize;
 };
 
+// An overlay entry as it is stored, but stripped down to a raw deflate stream
+// so that it can go into a zip file as is.
+struct DeflatedOverlayEntry {
+    std::vector<uint8_t> data;
+    uint32_t crc32;
+    uint32_t inflatedSize;
+};
+
+// receives an inflated overlay entry piece by piece
+typedef std::function<void(const uint8_t* data, size_t size)> OverlaySink;
+
 class LSDOverlayReader;
 class DictionaryReader;
 class LSDDictionary {
     IBitStream* _bstr;
+    bool _concurrent;
     std::unique_ptr<DictionaryReader> _reader;
     std::unique_ptr<LSDOverlayReader> _overlayReader;
+    mutable std::once_flag _overlayIndexBuilt;
+    mutable std::unordered_map<std::u16string, OverlayHeading> _overlayIndex;
 public:
-    LSDDictionary(IBitStream* bitstream);
+    // In concurrent mode the decoder is loaded up front and every call reads
+    // through its own StreamCursor, so one dictionary can serve several
+    // threads at once. This requires a thread-safe readAt on the bitstream.
+    LSDDictionary(IBitStream* bitstream, bool concurrent = false);
+    bool concurrent() const;
     std::u16string name() const;
     std::u16string annotation() const;
     std::vector<unsigned char> const& icon() const;
     LSDHeader const& header() const;
     std::vector<ArticleHeading> readHeadings() const;
+    FrontCodedHeadings readFrontCodedHeadings(unsigned restartInterval = 16) const;
+    void foreachPlainHeading(std::function<void(std::u16string const& heading,
+                                                unsigned reference)> func) const;
     std::u16string readArticle(unsigned reference) const;
+    // Decodes many articles in one forward sweep over the articles region,
+    // reading at most chunkSize bytes at a time. func gets every distinct
+    // reference once, in ascending order.
+    void foreachArticle(std::vector<unsigned> const& references,
+                        std::function<void(unsigned reference, std::u16string const& article)> func,
+                        unsigned chunkSize = 1 << 20) const;
+    // The same sweep, with the result in the order of references.
+    std::vector<std::u16string> readArticles(std::vector<unsigned> const& references) const;
+    // hints that the article at reference, size bytes long, will be read soon
+    void prefetchArticle(unsigned reference, unsigned size) const;
+    unsigned articlesSize() const;
     std::vector<OverlayHeading> readOverlayHeadings() const;
     std::vector<uint8_t> readOverlayEntry(OverlayHeading const& heading) const;
+    // inflates the entry with memory use independent of its size
+    void inflateOverlayEntry(OverlayHeading const& heading, OverlaySink const& sink) const;
+    // the zlib stream of the entry as it is stored
+    std::vector<uint8_t> readOverlayStream(OverlayHeading const& heading) const;
+    DeflatedOverlayEntry readDeflatedOverlayEntry(OverlayHeading const& heading) const;
+    // inflateOverlayEntry and readDeflatedOverlayEntry for a stream that
+    // readOverlayStream has already returned, without reading it again
+    void inflateOverlayStream(OverlayHeading const& heading,
+                              std::vector<uint8_t> const& stream,
+                              OverlaySink const& sink) const;
+    DeflatedOverlayEntry deflatedOverlayEntry(OverlayHeading const& heading,
+                                              std::vector<uint8_t> stream) const;
+    // Looks an overlay entry up by name through an index that is built on
+    // first use. Returns nullptr if there is no such entry.
+    OverlayHeading const* findOverlayEntry(std::u16string const& name) const;
+    // Random access to the inflated contents of an overlay entry, or nullptr
+    // if there is no such entry. The stream reads from the dictionary's own
+    // stream and must not outlive the dictionary.
+    std::unique_ptr<IRandomAccessStream> openOverlayEntry(std::u16string const& name) const;
     bool supported() const;
     ~LSDDictionary();
 };
@@ -2,10 +2,14 @@
 #include "BitStream.h"
 #include "LenTable.h"
 
-#include <boost/locale.hpp>
 #include <map>
+#include <cstring>
 #include <assert.h>
 
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
+
 namespace dictlsd {
 
 int majorVersion(unsigned dictVersion) {
@@ -80,12 +84,139 @@ bool readReference(IBitStream& bstr, unsigned& reference, unsigned huffmanNumber
     return true;
 }
 
-std::string toUtf8(std::u16string u16str) {
-    return boost::locale::conv::utf_to_utf<char>(u16str);
+char* utf16ToUtf8(const char16_t* str, size_t length, char* out) {
+    size_t i = 0;
+    while (i < length) {
+#ifdef __SSE2__
+        // runs of ASCII go sixteen units at a time
+        const __m128i nonAscii = _mm_set1_epi16(static_cast<short>(0xff80));
+        const __m128i zero = _mm_setzero_si128();
+        for (; i + 16 <= length; i += 16) {
+            auto lo = _mm_loadu_si128(reinterpret_cast<const __m128i*>(str + i));
+            auto hi = _mm_loadu_si128(reinterpret_cast<const __m128i*>(str + i + 8));
+            auto high = _mm_and_si128(_mm_or_si128(lo, hi), nonAscii);
+            if (_mm_movemask_epi8(_mm_cmpeq_epi8(high, zero)) != 0xffff)
+                break;
+            _mm_storeu_si128(reinterpret_cast<__m128i*>(out), _mm_packus_epi16(lo, hi));
+            out += 16;
+        }
+        if (i == length)
+            break;
+#endif
+        // and four at a time without SSE2 or near the end
+        uint64_t units;
+        if (i + 4 <= length) {
+            memcpy(&units, str + i, 8);
+            if (!(units & 0xff80ff80ff80ff80ull)) {
+                out[0] = str[i];
+                out[1] = str[i + 1];
+                out[2] = str[i + 2];
+                out[3] = str[i + 3];
+                out += 4;
+                i += 4;
+                continue;
+            }
+        }
+        char32_t c = str[i++];
+        if (c < 0x80) {
+            *out++ = c;
+        } else if (c < 0x800) {
+            *out++ = 0xc0 | (c >> 6);
+            *out++ = 0x80 | (c & 0x3f);
+        } else if (c < 0xd800 || c >= 0xe000) {
+            *out++ = 0xe0 | (c >> 12);
+            *out++ = 0x80 | ((c >> 6) & 0x3f);
+            *out++ = 0x80 | (c & 0x3f);
+        } else if (c < 0xdc00 && i < length && str[i] >= 0xdc00 && str[i] < 0xe000) {
+            c = 0x10000 + ((c - 0xd800) << 10) + (str[i++] - 0xdc00);
+            *out++ = 0xf0 | (c >> 18);
+            *out++ = 0x80 | ((c >> 12) & 0x3f);
+            *out++ = 0x80 | ((c >> 6) & 0x3f);
+            *out++ = 0x80 | (c & 0x3f);
+        }
+    }
+    return out;
+}
+
+char16_t* utf8ToUtf16(const char* str, size_t length, char16_t* out) {
+    auto bytes = reinterpret_cast<const uint8_t*>(str);
+    size_t i = 0;
+    while (i < length) {
+#ifdef __SSE2__
+        const __m128i zero = _mm_setzero_si128();
+        for (; i + 16 <= length; i += 16) {
+            auto chunk = _mm_loadu_si128(reinterpret_cast<const __m128i*>(bytes + i));
+            if (_mm_movemask_epi8(chunk))
+                break;
+            _mm_storeu_si128(reinterpret_cast<__m128i*>(out), _mm_unpacklo_epi8(chunk, zero));
+            _mm_storeu_si128(reinterpret_cast<__m128i*>(out + 8), _mm_unpackhi_epi8(chunk, zero));
+            out += 16;
+        }
+        if (i == length)
+            break;
+#endif
+        uint8_t lead = bytes[i++];
+        if (lead < 0x80) {
+            *out++ = lead;
+            continue;
+        }
+        unsigned count;
+        char32_t c, min;
+        if (lead >= 0xc2 && lead < 0xe0) {
+            count = 1;
+            c = lead & 0x1f;
+            min = 0x80;
+        } else if (lead >= 0xe0 && lead < 0xf0) {
+            count = 2;
+            c = lead & 0x0f;
+            min = 0x800;
+        } else if (lead >= 0xf0 && lead < 0xf5) {
+            count = 3;
+            c = lead & 0x07;
+            min = 0x10000;
+        } else {
+            continue;
+        }
+        // an invalid sequence is dropped up to the first byte that doesn't
+        // belong to it
+        unsigned read = 0;
+        for (; read < count && i + read < length && (bytes[i + read] & 0xc0) == 0x80; ++read) {
+            c = (c << 6) | (bytes[i + read] & 0x3f);
+        }
+        i += read;
+        if (read < count || c < min || c > 0x10ffff || (c >= 0xd800 && c < 0xe000))
+            continue;
+        if (c >= 0x10000) {
+            c -= 0x10000;
+            *out++ = 0xd800 + (c >> 10);
+            *out++ = 0xdc00 + (c & 0x3ff);
+        } else {
+            *out++ = c;
+        }
+    }
+    return out;
+}
+
+void toUtf8(std::u16string const& u16str, std::string& out) {
+    out.resize(3 * u16str.size());
+    out.resize(utf16ToUtf8(u16str.data(), u16str.size(), &out[0]) - out.data());
 }
 
-std::u16string toUtf16(std::string u8str) {
-    return boost::locale::conv::utf_to_utf<char16_t>(u8str);
+void toUtf16(std::string const& u8str, std::u16string& out) {
+    out.resize(u8str.size());
+    out.resize(utf8ToUtf16(u8str.data(), u8str.size(), &out[0]) - out.data());
+}
+
+std::string toUtf8(std::u16string const& u16str) {
+    std::string str;
+    toUtf8(u16str, str);
+    return str;
+}
+
+std::u16string toUtf16(std::string const& u8str) {
+    std::u16string str;
+    toUtf16(u8str, str);
+    return str;
 }
 
 std::map<int, std::u16string> langMap {
@@ -18,8 +18,18 @@ std::vector<char32_t> readSymbols(IBitStream* bstr);
 bool readReference(IBitStream& bstr, unsigned& reference, unsigned huffmanNumber);
 uint16_t reverse16(uint16_t n);
 uint32_t reverse32(uint32_t n);
-std::string toUtf8(std::u16string u16str);
-std::u16string toUtf16(std::string u8str);
+std::string toUtf8(std::u16string const& u16str);
+std::u16string toUtf16(std::string const& u8str);
+// the same conversions reusing the memory of out
+void toUtf8(std::u16string const& u16str, std::string& out);
+void toUtf16(std::string const& u8str, std::u16string& out);
+// writes the UTF-8 form of str to out, which must have room for 3 bytes per
+// UTF-16 unit, and returns the end of the output; unpaired surrogates are
+// skipped
+char* utf16ToUtf8(const char16_t* str, size_t length, char* out);
+// writes the UTF-16 form of str to out, which must have room for a unit per
+// byte, and returns the end of the output; invalid sequences are skipped
+char16_t* utf8ToUtf16(const char* str, size_t length, char16_t* out);
 std::u16string langFromCode(int code);
 void printLanguages(std::ostream& log);
 int majorVersion(unsigned dictVersion);
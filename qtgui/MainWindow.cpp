@@ -4,7 +4,9 @@
 #include "../DslWriter.h"
 #include "../dictlsd/lsd.h"
 #include "../dictlsd/LSAReader.h"
+#include "../dictlsd/ArchiveStream.h"
 #include "../dictlsd/tools.h"
+#include "../dictlsd/TaskScheduler.h"
 
 #include <QTableView>
 #include <QAbstractListModel>
@@ -31,96 +33,111 @@
 #include <QThread>
 
 #include <vector>
+#include <map>
 #include <memory>
+#include <mutex>
 #include <algorithm>
 #include <assert.h>
 
 using namespace dictlsd;
 
+// What the list shows of a dictionary, read when it's added. The file is
+// opened again only to be converted, so that a large library doesn't keep
+// a stream per dictionary, with an inflate state and cached spans for each
+// one inside an archive.
 class DictionaryEntry {
-    std::unique_ptr<FileStream> _stream;
     QString _path;
     QString _fileName;
 protected:
-    std::unique_ptr<BitStreamAdapter> _adapter;
+    FilePool* _pool;
+    QString _name;
+    QString _source;
+    QString _target;
+    unsigned _entries = 0;
+    QString _version;
+    std::vector<unsigned char> _icon;
+    bool _supported = true;
 public:
-    DictionaryEntry(QString path)
-        : _stream(new FileStream(path.toStdString())),
-          _path(path),
-          _fileName(QFileInfo(path).fileName()),
-          _adapter(new BitStreamAdapter(_stream.get()))
+    DictionaryEntry(QString path, FilePool* pool)
+        : _path(path),
+          _fileName(QString::fromStdString(dictionaryFileName(path.toStdString()))),
+          _pool(pool)
     { }
     QString path() { return _path; }
     QString fileName() { return _fileName; }
-    virtual QString name() = 0;
-    virtual QString source() = 0;
-    virtual QString target() = 0;
-    virtual unsigned entries() = 0;
-    virtual QString version() = 0;
-    virtual std::vector<unsigned char> const& icon() = 0;
-    virtual bool supported() = 0;
+    QString name() { return _name; }
+    QString source() { return _source; }
+    QString target() { return _target; }
+    unsigned entries() { return _entries; }
+    QString version() { return _version; }
+    std::vector<unsigned char> const& icon() { return _icon; }
+    bool supported() { return _supported; }
     virtual void dump(QString outDir, std::function<void(int)> log) = 0;
+    virtual ~DictionaryEntry() { }
 };
 
 class LSDDictionaryEntry : public DictionaryEntry {
-    LSDDictionary _reader;
-    QString printLanguage(int code) {
-        return QString::fromStdString(toUtf8(langFromCode(code)));
+    static QString printLanguage(int code) {
+        return QString("%1 (%2)").arg(code).arg(QString::fromStdString(toUtf8(langFromCode(code))));
     }
 public:
-    LSDDictionaryEntry(QString path)
-        : DictionaryEntry(path),
-          _reader(_adapter.get()) { }
-    virtual QString name(){
-        return QString::fromStdString(toUtf8(_reader.name()));
-    }
-    virtual QString source() {
-        auto source = _reader.header().sourceLanguage;
-        return QString("%1 (%2)").arg(source).arg(printLanguage(source));
-    }
-    virtual QString target() {
-        auto target = _reader.header().targetLanguage;
-        return QString("%1 (%2)").arg(target).arg(printLanguage(target));
-    }
-    virtual unsigned entries() {
-        return _reader.header().entriesCount;
-    }
-    virtual QString version() {
-        return QString("%1").arg(_reader.header().version, 1, 16);
-    }
-    virtual const std::vector<unsigned char> &icon() {
-        return _reader.icon();
-    }
-    virtual bool supported() {
-        return _reader.supported();
+    LSDDictionaryEntry(QString path, FilePool* pool)
+        : DictionaryEntry(path, pool)
+    {
+        auto file = openDictionaryStream(path.toStdString(), pool);
+        BitStreamAdapter bstr(file.get());
+        LSDDictionary reader(&bstr);
+        auto& header = reader.header();
+        _name = QString::fromStdString(toUtf8(reader.name()));
+        _source = printLanguage(header.sourceLanguage);
+        _target = printLanguage(header.targetLanguage);
+        _entries = header.entriesCount;
+        _version = QString("%1").arg(header.version, 1, 16);
+        _icon = reader.icon();
+        _supported = reader.supported();
     }
     virtual void dump(QString outDir, std::function<void(int)> log) {
-        writeDSL(&_reader, fileName().toStdString(), outDir.toStdString(), false, [&](int i, std::string) { log(i); });
+        // A concurrent reader lets writeDSL run its phases side by side.
+        auto file = openDictionaryStream(path().toStdString(), _pool);
+        PrefetchStream ras(file.get());
+        BitStreamAdapter bstr(&ras);
+        LSDDictionary reader(&bstr, true);
+        writeDSL(&reader, fileName().toStdString(), outDir.toStdString(), DslWriterOptions(), [&](int i, std::string) { log(i); });
     }
 };
 
 class LSADictionaryEntry : public DictionaryEntry {
-    LSAReader _reader;
-    std::vector<unsigned char> _icon = {};
 public:
-    LSADictionaryEntry(QString path)
-        : DictionaryEntry(path),
-          _reader(_adapter.get()) { }
-    virtual QString name() { return ""; }
-    virtual QString source() { return ""; }
-    virtual QString target() { return ""; }
-    virtual unsigned entries() { return _reader.entriesCount(); }
-    virtual QString version() { return ""; }
-    virtual const std::vector<unsigned char> &icon() { return _icon; }
-    virtual bool supported() { return true; }
+    LSADictionaryEntry(QString path, FilePool* pool)
+        : DictionaryEntry(path, pool)
+    {
+        auto file = openDictionaryStream(path.toStdString(), pool);
+        LSAReader reader(file.get());
+        _entries = reader.entriesCount();
+    }
     virtual void dump(QString outDir, std::function<void(int)> log) {
         decodeLSA(path().toStdString(), outDir.toStdString(), log);
     }
 };
 
 class LSDListModel : public QAbstractListModel {
+    // large libraries would otherwise run out of descriptors
+    FilePool _pool;
     std::vector<std::unique_ptr<DictionaryEntry>> _dicts;
     std::vector<QString> _columns;
+    void addDictionary(QString path) {
+        auto name = QString::fromStdString(dictionaryFileName(path.toStdString()));
+        QString ext = QFileInfo(name).suffix().toLower();
+        try {
+            if (ext == "lsd") {
+                _dicts.emplace_back(new LSDDictionaryEntry(path, &_pool));
+            } else if (ext == "lsa") {
+                _dicts.emplace_back(new LSADictionaryEntry(path, &_pool));
+            }
+        } catch(std::exception& e) {
+            QMessageBox::warning(nullptr, QString(e.what()), path);
+        }
+    }
 public:
     LSDListModel() {
         _columns = {
@@ -149,12 +166,13 @@ public:
             return true;
         for (QUrl fileUri : data->urls()) {
             QString path = fileUri.toLocalFile();
+            if (QFileInfo(path).suffix().toLower() != "zip") {
+                addDictionary(path);
+                continue;
+            }
             try {
-                QString ext = QFileInfo(path).suffix().toLower();
-                if (ext == "lsd") {
-                    _dicts.emplace_back(new LSDDictionaryEntry(path));
-                } else if (ext == "lsa") {
-                    _dicts.emplace_back(new LSADictionaryEntry(path));
+                for (auto& entry : listArchiveDictionaries(path.toStdString())) {
+                    addDictionary(path + "/" + QString::fromStdString(entry));
                 }
             } catch(std::exception& e) {
                 QMessageBox::warning(nullptr, QString(e.what()), path);
@@ -218,26 +236,76 @@ class ConvertWithProgress : public QObject {
 signals:
     void statusUpdated(int percent);
     void nextDictionary(QString name);
+    void dictionaryDone();
     void error(QString dict, QString message);
     void done();
 public:
     ConvertWithProgress(std::vector<DictionaryEntry*> dicts, QString outDir)
         : _dicts(dicts), _outDir(outDir) { }
 public slots:
+    // The dictionaries are converted side by side by tasks of the scheduler.
+    // The progress shown is the overall one, a finished dictionary counting
+    // as 100 percent. After the first error the other conversions stop at
+    // their next progress report. The error is only reported once all of
+    // them have stopped, as the window is usable again from then on.
     void start() {
-        for (DictionaryEntry* dict : _dicts) {
-            emit nextDictionary(dict->fileName());
-            try {
-                dict->dump(_outDir, [&](int percent) {
-                    emit statusUpdated(percent);
-                });
-            } catch (std::exception& e) {
-                emit error(dict->fileName(), e.what());
-                return;
+        struct Cancelled { };
+        TaskGroup tasks;
+        std::mutex mutex;
+        std::map<DictionaryEntry*, int> percents;
+        int reported = 0;
+        bool failed = false;
+        QString failedDict, failedMessage;
+        auto report = [&] {
+            int total = 0;
+            for (auto& dict : percents) {
+                total += dict.second;
+            }
+            int overall = total / std::max<int>(1, _dicts.size());
+            if (overall > reported) {
+                reported = overall;
+                emit statusUpdated(overall);
             }
-            emit statusUpdated(100);
+        };
+        for (DictionaryEntry* dict : _dicts) {
+            tasks.run([&, dict] {
+                {
+                    std::lock_guard<std::mutex> lock(mutex);
+                    if (failed)
+                        return;
+                    emit nextDictionary(dict->fileName());
+                }
+                try {
+                    dict->dump(_outDir, [&](int percent) {
+                        std::lock_guard<std::mutex> lock(mutex);
+                        if (failed)
+                            throw Cancelled();
+                        percents[dict] = percent;
+                        report();
+                    });
+                } catch (Cancelled&) {
+                    return;
+                } catch (std::exception& e) {
+                    std::lock_guard<std::mutex> lock(mutex);
+                    if (!failed) {
+                        failed = true;
+                        failedDict = dict->fileName();
+                        failedMessage = e.what();
+                    }
+                    return;
+                }
+                std::lock_guard<std::mutex> lock(mutex);
+                percents[dict] = 100;
+                report();
+                emit dictionaryDone();
+            });
+        }
+        tasks.wait();
+        if (failed) {
+            emit error(failedDict, failedMessage);
+        } else {
+            emit done();
         }
-        emit done();
     }
 };
 
@@ -274,6 +342,7 @@ void MainWindow::convert(bool selectedOnly) {
 
     _progress->setMaximum(dicts.size() + 1);
     _progress->setValue(0);
+    _dictProgress->setValue(0);
 
     auto thread = new QThread();
     auto converter = new ConvertWithProgress(dicts, dir);
@@ -283,10 +352,11 @@ void MainWindow::convert(bool selectedOnly) {
         _dictProgress->setValue(percent);
     });
     connect(converter, &ConvertWithProgress::nextDictionary, this, [=](QString name) {
-        _progress->setValue(_progress->value() + 1);
-        _dictProgress->setValue(0);
         _currentDict->setText(name + "...");
     });
+    connect(converter, &ConvertWithProgress::dictionaryDone, this, [=] {
+        _progress->setValue(_progress->value() + 1);
+    });
     auto enable = [=]{
         _tableView->setEnabled(true);
         _convertAllButton->setEnabled(true);
@@ -4,12 +4,27 @@
 #include "dictlsd/BitStream.h"
 #include "dictlsd/ArticleHeading.h"
 #include "dictlsd/CachePage.h"
+#include "dictlsd/FrontCodedHeadings.h"
+#include "dictlsd/UringFileStream.h"
+#include "dictlsd/FilePool.h"
+#include "dictlsd/ArchiveStream.h"
+#include "dictlsd/OutputSink.h"
+#include "dictlsd/DictzipSink.h"
+#include "dictlsd/TaskScheduler.h"
+#include "dictlsd/LSAReader.h"
 #include "ZipWriter.h"
+#include "DslWriter.h"
 #include "dictlsd/tools.h"
 
 #include <gtest/gtest.h>
+#include <zlib.h>
+#include <vorbis/vorbisenc.h>
+#include <minizip/unzip.h>
 #include <boost/lexical_cast.hpp>
 #include <boost/format.hpp>
+#include <boost/filesystem.hpp>
+#include <boost/algorithm/string.hpp>
+#include <boost/locale/encoding_utf.hpp>
 #include <boost/interprocess/streams/bufferstream.hpp>
 #include <tuple>
 #include <algorithm>
@@ -17,6 +32,10 @@
 #include <fstream>
 #include <iostream>
 #include <fstream>
+#include <thread>
+#include <atomic>
+#include <chrono>
+#include <cmath>
 
 using namespace dictlsd;
 
@@ -87,6 +106,29 @@ TEST(Tests, bitStreamTest) {
     ASSERT_EQ(2, bstr.tell());
 }
 
+TEST(Tests, xoringReadAtTest) {
+    std::vector<uint8_t> buf(300);
+    for (unsigned i = 0; i < buf.size(); ++i) {
+        buf[i] = i * 37 + 11;
+    }
+    const unsigned start = 5;
+    InMemoryStream ras(&buf[0], buf.size());
+    ras.seek(start);
+    XoringStreamAdapter sequential(&ras);
+    std::vector<uint8_t> expected(buf.size() - start);
+    sequential.readSome(&expected[0], expected.size());
+
+    ras.seek(start);
+    XoringStreamAdapter adapter(&ras);
+    for (unsigned pos : {0u, 1u, 2u, 100u, 254u, 294u}) {
+        std::vector<uint8_t> chunk(expected.size() - pos);
+        ASSERT_EQ(chunk.size(), adapter.readAt(start + pos, &chunk[0], chunk.size()));
+        ASSERT_TRUE(std::equal(chunk.begin(), chunk.end(), expected.begin() + pos)) << pos;
+    }
+    uint8_t byte;
+    ASSERT_THROW(adapter.readAt(start - 1, &byte, 1), std::logic_error);
+}
+
 TEST(Tests, decoderTest) {
     std::fstream f("simple_testdict1/test.lsd", std::ios::in | std::ios::binary);
     ASSERT_TRUE(f.is_open());
@@ -112,6 +154,535 @@ TEST(Tests, decoderTest) {
     ASSERT_TRUE(u"1234" == decoder.readArticle(heads[2].articleReference()));
 }
 
+TEST(Tests, concurrentReadsTest) {
+    auto buf = read_all_bytes("simple_testdict1/variants_testdict.lsd");
+    InMemoryStream ras(&buf[0], buf.size());
+    BitStreamAdapter bstr(&ras);
+    LSDDictionary reader(&bstr, true);
+    auto heads = reader.readHeadings();
+    std::vector<std::u16string> articles;
+    for (auto& heading : heads) {
+        articles.push_back(reader.readArticle(heading.articleReference()));
+    }
+    auto annotation = reader.annotation();
+
+    std::vector<std::thread> threads;
+    std::vector<int> failures(4, 0);
+    for (size_t t = 0; t < failures.size(); ++t) {
+        threads.emplace_back([&, t] {
+            for (int round = 0; round < 50; ++round) {
+                auto threadHeads = reader.readHeadings();
+                failures[t] += threadHeads.size() != heads.size();
+                for (size_t i = 0; i < heads.size(); ++i) {
+                    auto article = reader.readArticle(heads[i].articleReference());
+                    failures[t] += article != articles[i];
+                }
+                failures[t] += reader.annotation() != annotation;
+            }
+        });
+    }
+    for (auto& thread : threads) {
+        thread.join();
+    }
+    for (int count : failures) {
+        ASSERT_EQ(0, count);
+    }
+}
+
+TEST(Tests, readArticlesTest) {
+    auto buf = read_all_bytes("simple_testdict1/variants_testdict.lsd");
+    BitStreamAdapter bstr(new InMemoryStream(&buf[0], buf.size()));
+    LSDDictionary reader(&bstr);
+    auto heads = reader.readHeadings();
+    std::vector<unsigned> references;
+    for (auto it = heads.rbegin(); it != heads.rend(); ++it) {
+        references.push_back(it->articleReference());
+    }
+    references.push_back(heads[0].articleReference());
+    auto articles = reader.readArticles(references);
+    ASSERT_EQ(references.size(), articles.size());
+    for (size_t i = 0; i < references.size(); ++i) {
+        ASSERT_EQ(reader.readArticle(references[i]), articles[i]);
+    }
+}
+
+// counts the bytes read through positional reads
+class CountingStream : public InMemoryStream {
+public:
+    unsigned bytesRead = 0;
+    unsigned largestRead = 0;
+    CountingStream(const void* buf, unsigned size) : InMemoryStream(buf, size) { }
+    virtual unsigned readAt(uint64_t pos, void* dest, unsigned byteCount) override {
+        unsigned count = InMemoryStream::readAt(pos, dest, byteCount);
+        bytesRead += count;
+        largestRead = std::max(largestRead, byteCount);
+        return count;
+    }
+};
+
+TEST(Tests, sparseArticlesTest) {
+    // articles at 0, 3, 8, 13 and 18, the region is 23 bytes long
+    auto buf = read_all_bytes("simple_testdict1/variants_testdict.lsd");
+    CountingStream ras(&buf[0], buf.size());
+    BitStreamAdapter bstr(&ras);
+    LSDDictionary reader(&bstr);
+    ASSERT_EQ(23u, reader.articlesSize());
+    // chunks smaller than some of the articles, which then need refills
+    const unsigned chunkSize = 4;
+    auto sweep = [&](std::vector<unsigned> references) {
+        ras.bytesRead = 0;
+        ras.largestRead = 0;
+        std::vector<std::pair<unsigned, std::u16string>> articles;
+        reader.foreachArticle(references, [&](unsigned reference, std::u16string const& article) {
+            articles.push_back({reference, article});
+        }, chunkSize);
+        unsigned bytesRead = ras.bytesRead;
+        EXPECT_GE(chunkSize, ras.largestRead);
+        EXPECT_EQ(references.size(), articles.size());
+        for (auto& article : articles) {
+            EXPECT_EQ(reader.readArticle(article.first), article.second);
+        }
+        return bytesRead;
+    };
+    // the 3 byte article fits the first chunk
+    ASSERT_EQ(4u, sweep({0}));
+    // the 5 byte article at 13 takes its chunk and a refill
+    ASSERT_EQ(8u, sweep({13}));
+    ASSERT_EQ(12u, sweep({0, 13}));
+    ASSERT_EQ(20u, sweep({0, 8, 18}));
+}
+
+TEST(Tests, farApartArticlesTest) {
+    // articles at 0, 4, 9, 13, 18, 23 and 27, the region is 31 bytes long
+    auto buf = read_all_bytes("simple_testdict1/headingsTestDict1_x5.lsd");
+    CountingStream ras(&buf[0], buf.size());
+    BitStreamAdapter bstr(&ras);
+    LSDDictionary reader(&bstr);
+    for (auto references : {std::vector<unsigned>{27},
+                            std::vector<unsigned>{27, 0, 27},
+                            std::vector<unsigned>{13, 0},
+                            std::vector<unsigned>{0, 27, 9}}) {
+        ras.bytesRead = 0;
+        auto articles = reader.readArticles(references);
+        // the sweep starts at the smallest reference and stops at the region end
+        unsigned first = *std::min_element(begin(references), end(references));
+        ASSERT_EQ(reader.articlesSize() - first, ras.bytesRead);
+        ASSERT_EQ(references.size(), articles.size());
+        for (size_t i = 0; i < references.size(); ++i) {
+            ASSERT_EQ(reader.readArticle(references[i]), articles[i]);
+        }
+    }
+}
+
+TEST(Tests, readBatchTest) {
+    auto path = "simple_testdict1/variants_testdict.lsd";
+    auto buf = read_all_bytes(path);
+    UringFileStream file(path);
+    // returns the number of requests that didn't read what they should
+    auto readAll = [&] {
+        std::vector<std::vector<uint8_t>> dests;
+        std::vector<ReadRequest> requests;
+        for (unsigned pos = 0; pos < buf.size() + 100; pos += 37) {
+            dests.emplace_back(pos % 300);
+            requests.push_back({pos, dests.back().data(), (unsigned)dests.back().size(), 0});
+        }
+        std::vector<int> completions(requests.size());
+        file.readBatch(requests, [&](ReadRequest& request) {
+            completions[&request - &requests[0]]++;
+        });
+        int failures = 0;
+        for (size_t i = 0; i < requests.size(); ++i) {
+            auto& request = requests[i];
+            unsigned expected = request.pos < buf.size()
+                    ? std::min<unsigned>(request.byteCount, buf.size() - request.pos)
+                    : 0;
+            failures += completions[i] != 1 ||
+                        request.bytesRead != expected ||
+                        !std::equal(dests[i].begin(), dests[i].begin() + expected, buf.begin() + request.pos);
+        }
+        return failures;
+    };
+    // the ring of the stream is reused by later batches and shared by
+    // concurrent ones
+    ASSERT_EQ(0, readAll());
+    ASSERT_EQ(0, readAll());
+    std::vector<std::thread> threads;
+    std::vector<int> failures(4);
+    for (size_t t = 0; t < failures.size(); ++t) {
+        threads.emplace_back([&, t] {
+            for (int k = 0; k < 20; ++k) {
+                failures[t] += readAll();
+            }
+        });
+    }
+    for (auto& thread : threads) {
+        thread.join();
+    }
+    for (int count : failures) {
+        ASSERT_EQ(0, count);
+    }
+}
+
+// a virtual 8 GiB stream whose bytes are derived from their positions
+class PatternStream : public IRandomAccessStream {
+    uint64_t _pos = 0;
+public:
+    static const uint64_t size = 8ull << 30;
+    static uint8_t at(uint64_t pos) {
+        return (pos ^ (pos >> 32)) & 0xFF;
+    }
+    virtual unsigned readSome(void* dest, unsigned byteCount) override {
+        unsigned count = readAt(_pos, dest, byteCount);
+        _pos += count;
+        return count;
+    }
+    virtual void seek(uint64_t pos) override { _pos = pos; }
+    virtual uint64_t tell() override { return _pos; }
+    virtual unsigned readAt(uint64_t pos, void* dest, unsigned byteCount) override {
+        auto out = static_cast<uint8_t*>(dest);
+        unsigned i = 0;
+        for (; i < byteCount && pos + i < size; ++i) {
+            out[i] = at(pos + i);
+        }
+        return i;
+    }
+};
+
+TEST(Tests, largeOffsetsTest) {
+    PatternStream pattern;
+    StreamCursor cursor(&pattern);
+    uint64_t pos = (4ull << 30) - 1000;
+    cursor.seek(pos);
+    std::vector<uint8_t> buf(3000);
+    ASSERT_EQ(buf.size(), cursor.readSome(buf.data(), buf.size()));
+    ASSERT_EQ(pos + buf.size(), cursor.tell());
+    for (size_t i = 0; i < buf.size(); ++i) {
+        ASSERT_EQ(PatternStream::at(pos + i), buf[i]);
+    }
+    cursor.seek(PatternStream::size - 10);
+    ASSERT_EQ(10u, cursor.readSome(buf.data(), buf.size()));
+    BitStreamAdapter bstr(&pattern);
+    bstr.seek(5ull << 30);
+    ASSERT_EQ(PatternStream::at(5ull << 30), bstr.read(8));
+    ASSERT_EQ((5ull << 30) + 1, bstr.tell());
+}
+
+TEST(Tests, filePoolTest) {
+    std::vector<std::string> paths {
+        "simple_testdict1/headingsTestDict1_12.lsd",
+        "simple_testdict1/unsorted_testdict.lsd",
+        "simple_testdict1/variants_testdict.lsd"
+    };
+    FilePool pool(2);
+    std::vector<std::unique_ptr<PooledFileStream>> streams;
+    std::vector<std::unique_ptr<BitStreamAdapter>> adapters;
+    std::vector<std::unique_ptr<LSDDictionary>> readers;
+    for (auto& path : paths) {
+        streams.emplace_back(new PooledFileStream(&pool, path));
+        adapters.emplace_back(new BitStreamAdapter(streams.back().get()));
+        readers.emplace_back(new LSDDictionary(adapters.back().get()));
+        ASSERT_GE(2u, pool.openCount());
+    }
+    for (size_t i = 0; i < paths.size(); ++i) {
+        auto buf = read_all_bytes(paths[i].c_str());
+        BitStreamAdapter bstr(new InMemoryStream(&buf[0], buf.size()));
+        LSDDictionary expected(&bstr);
+        auto heads = readers[i]->readHeadings();
+        auto expectedHeads = expected.readHeadings();
+        ASSERT_EQ(expectedHeads.size(), heads.size());
+        for (size_t j = 0; j < heads.size(); ++j) {
+            ASSERT_EQ(expectedHeads[j].dslText(), heads[j].dslText());
+            ASSERT_EQ(expected.readArticle(expectedHeads[j].articleReference()),
+                      readers[i]->readArticle(heads[j].articleReference()));
+            ASSERT_GE(2u, pool.openCount());
+        }
+    }
+    // a stream going away leaves the file open for another one on the path
+    PooledFileStream second(&pool, paths[0]);
+    ASSERT_EQ(2u, pool.openCount());
+    readers.erase(begin(readers));
+    adapters.erase(begin(adapters));
+    streams.erase(begin(streams));
+    ASSERT_EQ(2u, pool.openCount());
+    readers.clear();
+    adapters.clear();
+    streams.clear();
+    ASSERT_EQ(1u, pool.openCount());
+}
+
+// a small memLevel makes deflate emit many short blocks
+std::vector<uint8_t> deflateBuffer(std::vector<uint8_t> const& data, int windowBits) {
+    z_stream strm = {};
+    deflateInit2(&strm, Z_DEFAULT_COMPRESSION, Z_DEFLATED, windowBits, 1, Z_DEFAULT_STRATEGY);
+    std::vector<uint8_t> res(deflateBound(&strm, data.size()));
+    strm.next_in = const_cast<uint8_t*>(data.data());
+    strm.avail_in = data.size();
+    strm.next_out = res.data();
+    strm.avail_out = res.size();
+    deflate(&strm, Z_FINISH);
+    res.resize(strm.total_out);
+    deflateEnd(&strm);
+    return res;
+}
+
+TEST(Tests, inflateStreamTest) {
+    std::vector<uint8_t> plain;
+    auto dict = read_all_bytes("simple_testdict1/variants_testdict.lsd");
+    for (int i = 0; i < 50; ++i) {
+        for (uint8_t byte : dict) {
+            plain.push_back(byte ^ i);
+        }
+    }
+    size_t half = plain.size() / 2;
+    auto raw = deflateBuffer(plain, -15);
+    // two gzip members
+    auto gzip = deflateBuffer({begin(plain), begin(plain) + half}, 15 + 16);
+    auto second = deflateBuffer({begin(plain) + half, end(plain)}, 15 + 16);
+    gzip.insert(end(gzip), begin(second), end(second));
+    for (auto format : {DeflateFormat::Raw, DeflateFormat::Gzip}) {
+        auto& compressed = format == DeflateFormat::Raw ? raw : gzip;
+        std::unique_ptr<IRandomAccessStream> source(
+            new InMemoryStream(compressed.data(), compressed.size()));
+        InflateStream stream(std::move(source), 0, format, 4096);
+        std::vector<uint8_t> buf(10000);
+        for (uint64_t pos : {uint64_t(plain.size() - 5000), uint64_t(0), uint64_t(half - 3000),
+                             uint64_t(12345), uint64_t(plain.size() - 1)}) {
+            unsigned count = stream.readAt(pos, buf.data(), buf.size());
+            ASSERT_EQ(std::min<uint64_t>(buf.size(), plain.size() - pos), count);
+            ASSERT_TRUE(std::equal(begin(buf), begin(buf) + count, begin(plain) + pos));
+        }
+        ASSERT_EQ(0u, stream.readAt(plain.size(), buf.data(), buf.size()));
+    }
+}
+
+TEST(Tests, gzipDictionaryTest) {
+    auto path = "simple_testdict1/variants_testdict.lsd";
+    auto buf = read_all_bytes(path);
+    auto gzip = deflateBuffer(buf, 15 + 16);
+    auto gzPath = "simple_testdict1/variants_testdict.lsd.gz";
+    UnicodePathFile(gzPath, true).write((const char*)gzip.data(), gzip.size());
+    ASSERT_EQ("variants_testdict.lsd", dictionaryFileName(gzPath));
+    auto stream = openDictionaryStream(gzPath);
+    BitStreamAdapter gzipBstr(stream.get());
+    LSDDictionary reader(&gzipBstr);
+    BitStreamAdapter bstr(new InMemoryStream(&buf[0], buf.size()));
+    LSDDictionary expected(&bstr);
+    auto heads = reader.readHeadings();
+    auto expectedHeads = expected.readHeadings();
+    ASSERT_EQ(expectedHeads.size(), heads.size());
+    for (size_t i = 0; i < heads.size(); ++i) {
+        ASSERT_EQ(expectedHeads[i].dslText(), heads[i].dslText());
+        ASSERT_EQ(expected.readArticle(expectedHeads[i].articleReference()),
+                  reader.readArticle(heads[i].articleReference()));
+    }
+}
+
+TEST(Tests, outputSinkTest) {
+    auto path = "simple_testdict1/sink_test.bin";
+    std::vector<uint8_t> expected;
+    {
+        OutputSink sink(path, 64);
+        sink.preallocate(1 << 20);
+        for (unsigned size : {10u, 50u, 3u, 64u, 200u, 1u, 63u, 0u, 65u}) {
+            std::vector<uint8_t> chunk(size);
+            for (unsigned i = 0; i < size; ++i) {
+                chunk[i] = expected.size() + i;
+            }
+            sink.write(chunk.data(), chunk.size());
+            expected.insert(end(expected), begin(chunk), end(chunk));
+            char* room = sink.reserve(7);
+            memcpy(room, "reserve", 7);
+            sink.commit(7);
+            expected.insert(end(expected), room, room + 7);
+        }
+        sink.write(u"ab");
+        expected.insert(end(expected), {'a', 0, 'b', 0});
+        ASSERT_EQ(expected.size(), sink.size());
+        sink.close();
+    }
+    ASSERT_EQ(expected, read_all_bytes(path));
+}
+
+TEST(Tests, dictzipSinkTest) {
+    auto path = "simple_testdict1/sink_test.dz";
+    const unsigned chunkLength = DictzipSink::chunkLength;
+    TaskScheduler scheduler(3);
+    for (size_t total : {size_t(0), size_t(2 * chunkLength), size_t(70 * chunkLength + 12345)}) {
+        std::vector<char> data;
+        {
+            DictzipSink sink(path, scheduler);
+            unsigned seed = 1;
+            while (data.size() < total) {
+                size_t size = std::min<size_t>(total - data.size(), 1 + seed % sink.bufferSize());
+                char* out = sink.reserve(size);
+                for (size_t i = 0; i < size; ++i) {
+                    seed = seed * 1103515245 + 12345;
+                    out[i] = "abcdefgh \n"[(seed >> 16) % 10];
+                }
+                sink.commit(size);
+                data.insert(end(data), out, out + size);
+            }
+            sink.close();
+        }
+        // as a whole gzip stream
+        InflateStream gzip(std::unique_ptr<IRandomAccessStream>(new FileStream(path)), 0, DeflateFormat::Gzip);
+        std::vector<char> inflated(total + 1);
+        ASSERT_EQ(total, gzip.readAt(0, inflated.data(), inflated.size()));
+        inflated.resize(total);
+        ASSERT_EQ(data, inflated);
+        // and chunk by chunk through the RA field
+        auto file = read_all_bytes(path);
+        auto le16 = [&](size_t pos) { return unsigned(file[pos] | file[pos + 1] << 8); };
+        // a comment pads the header when it was written before the end
+        bool padded = total > 32 * chunkLength;
+        ASSERT_EQ(padded ? 4 | 16 : 4, file[3]);
+        ASSERT_EQ('R', file[12]);
+        ASSERT_EQ('A', file[13]);
+        ASSERT_EQ(chunkLength, le16(18));
+        unsigned count = le16(20);
+        ASSERT_EQ(std::max<size_t>(1, (total + chunkLength - 1) / chunkLength), count);
+        size_t offset = 12 + le16(10);
+        if (padded) {
+            offset = std::find(begin(file) + offset, end(file), 0) - begin(file) + 1;
+        }
+        for (unsigned i = 0; i < count; ++i) {
+            unsigned size = le16(22 + 2 * i);
+            std::vector<char> chunk(chunkLength);
+            z_stream strm = {};
+            ASSERT_EQ(Z_OK, inflateInit2(&strm, -15));
+            strm.next_in = &file[offset];
+            strm.avail_in = size;
+            strm.next_out = reinterpret_cast<Bytef*>(chunk.data());
+            strm.avail_out = chunk.size();
+            inflate(&strm, Z_SYNC_FLUSH);
+            chunk.resize(chunk.size() - strm.avail_out);
+            inflateEnd(&strm);
+            ASSERT_EQ(0u, strm.avail_in);
+            std::vector<char> expected(begin(data) + std::min<size_t>(total, i * chunkLength),
+                                       begin(data) + std::min<size_t>(total, (i + 1) * chunkLength));
+            ASSERT_EQ(expected, chunk);
+            offset += size;
+        }
+        ASSERT_EQ(file.size(), offset + 8);
+    }
+}
+
+TEST(Tests, taskGroupTest) {
+    // fewer threads than nested groups, so waiters have to run tasks themselves
+    TaskScheduler scheduler(2);
+    std::atomic<unsigned> sum(0);
+    std::function<void(unsigned)> spawn = [&](unsigned depth) {
+        sum += depth;
+        if (depth == 0)
+            return;
+        TaskGroup group(scheduler);
+        for (unsigned i = 0; i < 3; ++i) {
+            group.run([&, depth] { spawn(depth - 1); });
+        }
+        group.wait();
+    };
+    spawn(5);
+    ASSERT_EQ(5u + 3 * 4 + 9 * 3 + 27 * 2 + 81 * 1, sum.load());
+
+    TaskGroup group(scheduler);
+    group.run([] { throw std::runtime_error("task failed"); });
+    ASSERT_THROW(group.wait(), std::runtime_error);
+    bool ran = false;
+    group.run([&] { ran = true; });
+    group.wait();
+    ASSERT_TRUE(ran);
+
+    // the destructor waits for a running task but drops the queued ones
+    TaskScheduler single(1);
+    std::atomic<bool> started(false), release(false);
+    std::atomic<unsigned> queuedRan(0);
+    std::thread releaser;
+    {
+        TaskGroup blocked(single);
+        blocked.run([&] {
+            started = true;
+            while (!release) {
+                std::this_thread::yield();
+            }
+        });
+        while (!started) {
+            std::this_thread::yield();
+        }
+        for (unsigned i = 0; i < 10; ++i) {
+            blocked.run([&] { ++queuedRan; });
+        }
+        releaser = std::thread([&] {
+            std::this_thread::sleep_for(std::chrono::milliseconds(50));
+            release = true;
+        });
+    }
+    ASSERT_TRUE(release);
+    ASSERT_EQ(0u, queuedRan.load());
+    releaser.join();
+}
+
+// can't pass hints on to the OS, and counts the positional reads
+class UnhintedStream : public InMemoryStream {
+public:
+    std::atomic<unsigned> bytesRead;
+    UnhintedStream(const void* buf, unsigned size) : InMemoryStream(buf, size), bytesRead(0) { }
+    virtual unsigned readAt(uint64_t pos, void* dest, unsigned byteCount) override {
+        unsigned count = InMemoryStream::readAt(pos, dest, byteCount);
+        bytesRead += count;
+        return count;
+    }
+    virtual bool prefetch(uint64_t, unsigned) override {
+        return false;
+    }
+};
+
+TEST(Tests, prefetchStreamTest) {
+    std::vector<uint8_t> buf(1 << 20);
+    UnhintedStream ras(buf.data(), buf.size());
+    TaskScheduler scheduler(1);
+    PrefetchStream stream(&ras, scheduler);
+    ASSERT_TRUE(stream.prefetch(0, 300000));
+    ASSERT_TRUE(stream.prefetch(500000, 1000));
+    // the ranges are read ahead by a task of the scheduler
+    for (unsigned i = 0; i < 1000 && ras.bytesRead < 301000; ++i) {
+        std::this_thread::sleep_for(std::chrono::milliseconds(5));
+    }
+    ASSERT_EQ(301000u, ras.bytesRead.load());
+}
+
+TEST(Tests, utfConversionTest) {
+    std::vector<std::u16string> strings {
+        u"",
+        u"abc",
+        u"plain ascii text longer than a few units",
+        u"\u00e9t\u00e9 \u0434\u043e\u043c \u6f22\u5b57",
+        u"\U0001F600 pair at the start and the end \U0001D11E",
+        u"ab\u00ffcd\u07ff\u0800\uffff\U0010FFFF",
+    };
+    // non-ASCII units at every position of a long ASCII run
+    for (size_t i = 0; i < 40; ++i) {
+        std::u16string str(40, u'x');
+        str[i] = u'\u044f';
+        strings.push_back(str);
+    }
+    for (auto& str : strings) {
+        auto utf8 = boost::locale::conv::utf_to_utf<char>(str);
+        ASSERT_EQ(utf8, toUtf8(str));
+        ASSERT_EQ(str, toUtf16(utf8));
+    }
+    // unpaired surrogates are dropped
+    std::u16string invalid = u"a";
+    invalid += char16_t(0xd800);
+    invalid += u" b";
+    invalid += char16_t(0xdc00);
+    invalid += u"c";
+    invalid += char16_t(0xd83d);
+    ASSERT_EQ("a bc", toUtf8(invalid));
+    // as are stray continuation bytes, overlong forms, encoded surrogates
+    // and truncated sequences
+    ASSERT_EQ(u"a b c d e", toUtf16("a\x80 b\xc0\xaf c\xed\xa0\x80 d\xe6\x97 e\xf0\x9f"));
+}
+
 void assertFilesAreEqual(std::string path1, std::string path2) {
     auto flags = std::ios::in | std::ios::binary;
     std::ifstream file1(path1, flags);
@@ -157,6 +728,44 @@ TEST(Tests, userLsdHeadingsTest) {
     }
 }
 
+TEST(Tests, frontCodedHeadingsTest) {
+    for (auto path : {"simple_testdict1/headingsTestDict1_x5.lsd",
+                      "simple_testdict1/unsorted_testdict.lsd",
+                      "simple_testdict1/variants_testdict.lsd"}) {
+        auto buf = read_all_bytes(path);
+        BitStreamAdapter bstr(new InMemoryStream(&buf[0], buf.size()));
+        LSDDictionary reader(&bstr);
+        auto heads = reader.readHeadings();
+        auto store = reader.readFrontCodedHeadings(3);
+        ASSERT_EQ(heads.size(), store.size());
+        for (size_t i = heads.size(); i-- > 0;) {
+            auto heading = store.at(i);
+            ASSERT_EQ(heads[i].dslText(), heading.dslText());
+            ASSERT_EQ(heads[i].articleReference(), heading.articleReference());
+        }
+    }
+}
+
+TEST(Tests, plainHeadingsTest) {
+    for (auto path : {"simple_testdict1/headingsTestDict1_12.lsd",
+                      "simple_testdict1/testext.lsd",
+                      "simple_testdict1/unsorted_testdict.lsd",
+                      "simple_testdict1/variants_testdict.lsd"}) {
+        auto buf = read_all_bytes(path);
+        BitStreamAdapter bstr(new InMemoryStream(&buf[0], buf.size()));
+        LSDDictionary reader(&bstr);
+        auto heads = reader.readHeadings();
+        size_t i = 0;
+        reader.foreachPlainHeading([&](std::u16string const& heading, unsigned reference) {
+            ASSERT_LT(i, heads.size());
+            ASSERT_EQ(heads[i].text(), heading);
+            ASSERT_EQ(heads[i].articleReference(), reference);
+            ++i;
+        });
+        ASSERT_EQ(heads.size(), i);
+    }
+}
+
 TEST(Tests, overlayTest) {
     for (auto path : {"simple_testdict1/overlay_12.lsd",
                       "simple_testdict1/overlay_x3.lsd",
@@ -179,6 +788,89 @@ TEST(Tests, overlayTest) {
     }
 }
 
+TEST(Tests, deflatedOverlayTest) {
+    auto buf = read_all_bytes("simple_testdict1/overlay_x5.lsd");
+    BitStreamAdapter bstr(new InMemoryStream(&buf[0], buf.size()));
+    LSDDictionary reader(&bstr);
+    for (auto& heading : reader.readOverlayHeadings()) {
+        auto expected = reader.readOverlayEntry(heading);
+        auto entry = reader.readDeflatedOverlayEntry(heading);
+        ASSERT_EQ(expected.size(), entry.inflatedSize);
+        ASSERT_EQ(crc32(0, expected.data(), expected.size()), entry.crc32);
+        std::vector<uint8_t> inflated(expected.size() + 1);
+        z_stream strm = {};
+        ASSERT_EQ(Z_OK, inflateInit2(&strm, -15));
+        strm.next_in = entry.data.data();
+        strm.avail_in = entry.data.size();
+        strm.next_out = inflated.data();
+        strm.avail_out = inflated.size();
+        ASSERT_EQ(Z_STREAM_END, inflate(&strm, Z_FINISH));
+        ASSERT_EQ(0u, strm.avail_in);
+        inflated.resize(strm.total_out);
+        inflateEnd(&strm);
+        ASSERT_EQ(expected, inflated);
+        auto stream = reader.readOverlayStream(heading);
+        ASSERT_EQ(heading.streamSize, stream.size());
+        ASSERT_TRUE(std::equal(begin(entry.data), end(entry.data), begin(stream) + 2));
+    }
+}
+
+TEST(Tests, inflateOverlayTest) {
+    auto buf = read_all_bytes("simple_testdict1/overlay_x5.lsd");
+    BitStreamAdapter bstr(new InMemoryStream(&buf[0], buf.size()));
+    LSDDictionary reader(&bstr);
+    auto heading = reader.readOverlayHeadings().at(0);
+    auto inflate = [&](OverlayHeading const& heading) {
+        std::vector<uint8_t> res;
+        reader.inflateOverlayEntry(heading, [&](const uint8_t* data, size_t size) {
+            ASSERT_LE(size, 1u << 16);
+            res.insert(end(res), data, data + size);
+        });
+        return res;
+    };
+    ASSERT_EQ(read_all_bytes("simple_testdict1/image1.bmp"), inflate(heading));
+    auto truncated = heading;
+    truncated.streamSize -= 10;
+    ASSERT_THROW(inflate(truncated), std::runtime_error);
+    ASSERT_THROW(reader.readOverlayEntry(truncated), std::runtime_error);
+    auto wrongSize = heading;
+    wrongSize.inflatedSize -= 1;
+    ASSERT_THROW(inflate(wrongSize), std::runtime_error);
+    wrongSize.inflatedSize += 2;
+    ASSERT_THROW(reader.readOverlayEntry(wrongSize), std::runtime_error);
+}
+
+TEST(Tests, overlayIndexTest) {
+    auto buf = read_all_bytes("simple_testdict1/overlay_x3.lsd");
+    InMemoryStream stream(&buf[0], buf.size());
+    BitStreamAdapter bstr(&stream);
+    LSDDictionary reader(&bstr, true);
+    std::vector<std::thread> threads;
+    for (int i = 0; i < 4; ++i) {
+        threads.emplace_back([&] {
+            auto heading = reader.findOverlayEntry(u"image2.bmp");
+            ASSERT_TRUE(heading);
+            ASSERT_EQ(u"image2.bmp", heading->name);
+        });
+    }
+    for (auto& thread : threads) {
+        thread.join();
+    }
+    ASSERT_FALSE(reader.findOverlayEntry(u"image3.bmp"));
+    ASSERT_FALSE(reader.openOverlayEntry(u"image3.bmp"));
+
+    auto expected = read_all_bytes("simple_testdict1/image2.bmp");
+    auto entry = reader.openOverlayEntry(u"image2.bmp");
+    std::vector<uint8_t> image(expected.size() + 1);
+    ASSERT_EQ(expected.size(), entry->readAt(0, image.data(), image.size()));
+    image.resize(expected.size());
+    ASSERT_EQ(expected, image);
+    std::vector<uint8_t> tail(100);
+    entry->seek(expected.size() - 100);
+    ASSERT_EQ(100u, entry->readSome(tail.data(), tail.size()));
+    ASSERT_TRUE(std::equal(begin(tail), end(tail), end(expected) - 100));
+}
+
 TEST(Tests, extHeadingsTest) {
     std::fstream f("simple_testdict1/testext.lsd", std::ios::in | std::ios::binary);
     ASSERT_TRUE(f.is_open());
@@ -228,6 +920,9 @@ TEST(Tests, collapseVariantHeadingsTest) {
     ASSERT_EQ(12, reader.header().entriesCount);
     auto heads = reader.readHeadings();
     ASSERT_EQ(12, heads.size());
+    for (auto& heading : heads) {
+        heading.dslText(); // cached texts must be dropped by the collapse
+    }
     collapseVariants(heads);
     ASSERT_EQ(5, heads.size());
 
@@ -277,3 +972,550 @@ TEST(Tests, unicodePath2) {
     ASSERT_EQ(5, read);
     ASSERT_EQ(std::string("1234\n"), buf);
 }
+
+class MemorySink : public IOutputSink {
+    std::vector<char> _buf;
+    size_t _bufferSize;
+public:
+    std::string* data;
+    MemorySink(std::string* data, size_t bufferSize)
+        : _bufferSize(bufferSize), data(data) { }
+    char* reserve(size_t size) override {
+        _buf.resize(size);
+        return _buf.data();
+    }
+    void commit(size_t size) override {
+        data->append(_buf.data(), size);
+    }
+    size_t bufferSize() const override {
+        return _bufferSize;
+    }
+    void close() override { }
+};
+
+std::u16string expandNewlines(std::u16string const& str) {
+    std::u16string res;
+    for (auto ch : str) {
+        res += ch;
+        if (ch == u'\n')
+            res += u'\t';
+    }
+    return res;
+}
+
+TEST(Tests, writeArticleNewlinesTest) {
+    std::vector<std::vector<size_t>> newlines {
+        {},
+        {0},
+        {7},
+        {8},
+        {7, 8},
+        {15, 16, 17},
+        {0, 7, 8, 15, 16, 23, 24, 31, 32, 39},
+    };
+    for (auto positions : newlines) {
+        for (bool crlf : {false, true}) {
+            std::u16string article(40, u'a');
+            for (size_t i = 0; i < article.size(); ++i) {
+                article[i] += i % 26;
+            }
+            for (auto pos : positions) {
+                article[pos] = u'\n';
+                if (crlf && pos > 0)
+                    article[pos - 1] = u'\r';
+            }
+            auto expected = expandNewlines(article);
+            // a 64-byte buffer splits the article into pieces of 16 units
+            for (size_t bufferSize : {64, 1 << 16}) {
+                std::string utf16, utf8;
+                TextSink sink16(std::unique_ptr<IOutputSink>(new MemorySink(&utf16, bufferSize)),
+                                DslEncoding::Utf16);
+                TextSink sink8(std::unique_ptr<IOutputSink>(new MemorySink(&utf8, bufferSize)),
+                               DslEncoding::Utf8);
+                writeArticle(sink16, article.data(), article.size());
+                writeArticle(sink8, article.data(), article.size());
+                ASSERT_EQ(2 * expected.size(), utf16.size());
+                ASSERT_EQ(expected, std::u16string(reinterpret_cast<const char16_t*>(utf16.data()),
+                                                   utf16.size() / 2));
+                ASSERT_EQ(toUtf8(expected), utf8);
+            }
+        }
+    }
+}
+
+TEST(Tests, textSinkUtf8Test) {
+    std::string utf8;
+    TextSink sink(std::unique_ptr<IOutputSink>(new MemorySink(&utf8, 1 << 16)),
+                  DslEncoding::Utf8);
+    sink.write(u"\ufeff");
+    // U+1F600 with its surrogate pair split between two writes
+    sink.write(u"a\xd83d");
+    sink.write(u"\xde00" "b");
+    // an unpaired high surrogate is dropped as before
+    sink.write(u"\xd83d");
+    sink.write(u"c");
+    sink.close();
+    ASSERT_EQ(std::string("\xef\xbb\xbf" "a\xf0\x9f\x98\x80" "bc"), utf8);
+
+    std::string utf16;
+    TextSink sink16(std::unique_ptr<IOutputSink>(new MemorySink(&utf16, 1 << 16)),
+                    DslEncoding::Utf16);
+    sink16.write(u"\ufeff");
+    sink16.write(u"a\xd83d");
+    sink16.write(u"\xde00");
+    ASSERT_EQ(std::string("\xff\xfe" "a\0" "\x3d\xd8" "\x00\xde", 8), utf16);
+}
+
+TEST(Tests, overlayFilePathTest) {
+    ASSERT_EQ(boost::filesystem::path("image1.bmp"), overlayFilePath(u"image1.bmp"));
+    ASSERT_EQ(boost::filesystem::path("sub/dir/a..b.bmp"), overlayFilePath(u"sub/dir/a..b.bmp"));
+    for (auto name : {u"", u"..", u"../image1.bmp", u"sub/../../image1.bmp", u"/etc/passwd"}) {
+        ASSERT_THROW(overlayFilePath(name), std::runtime_error);
+    }
+}
+
+TEST(Tests, overlayDirectoryTest) {
+    namespace fs = boost::filesystem;
+    auto buf = read_all_bytes("simple_testdict1/overlay_x5.lsd");
+    BitStreamAdapter bstr(new InMemoryStream(&buf[0], buf.size()));
+    LSDDictionary reader(&bstr, true);
+    auto overlay = reader.readOverlayHeadings();
+    ASSERT_EQ(2, overlay.size());
+    // with equal sizes both entries are candidates for the same duplicate,
+    // so the second one is only inflated once it turns out not to be one
+    ASSERT_EQ(overlay[0].inflatedSize, overlay[1].inflatedSize);
+    auto streamSize = std::max(overlay[0].streamSize, overlay[1].streamSize);
+    overlay[0].streamSize = overlay[1].streamSize = streamSize;
+    std::vector<std::vector<uint8_t>> images {
+        read_all_bytes("simple_testdict1/image1.bmp"),
+        read_all_bytes("simple_testdict1/image2.bmp")
+    };
+    // enough entries for many batches, every one after the first two
+    // repeating one of them, followed by entries whose files collide with
+    // earlier ones: 41 to 44 share one file, 45 takes the one of 6 in upper
+    // case and 46 the one of 5. The first image with a stream size of its
+    // own isn't a repeat and is extracted right away, so 41, 42, 44 and 46
+    // race for their files with each other and with the repeats 43 and 5.
+    std::vector<OverlayHeading> headings;
+    std::string expectedAliases;
+    std::vector<unsigned> unique {41, 42, 44, 46};
+    for (unsigned i = 0; i < 47; ++i) {
+        auto heading = overlay[i % 2];
+        auto name = str(boost::format("sub%1%/%2%.bmp") % (i % 3) % i);
+        if (i >= 41 && i <= 44) {
+            name = "sub2/twice.bmp";
+        } else if (i == 45) {
+            name = boost::algorithm::to_upper_copy(toUtf8(headings[6].name));
+        } else if (i == 46) {
+            name = toUtf8(headings[5].name);
+        }
+        bool repeat = i >= 2;
+        auto it = std::find(begin(unique), end(unique), i);
+        if (it != end(unique)) {
+            heading = overlay[0];
+            heading.streamSize = streamSize - 1 - (it - begin(unique));
+            repeat = false;
+        }
+        heading.name = toUtf16(name);
+        headings.push_back(heading);
+        if (repeat) {
+            expectedAliases += name + "\t" + toUtf8(headings[i % 2].name) + "\n";
+        }
+    }
+    fs::path dir("simple_testdict1/overlay_dir_test.files");
+    fs::path aliases("simple_testdict1/overlay_dir_test.files.aliases");
+    fs::remove_all(dir);
+    writeOverlay(&reader, headings, dir, aliases, true);
+    for (unsigned i = 0; i < headings.size(); ++i) {
+        // the last entry written to a file wins; the file of a name that
+        // differs in case depends on the file system
+        bool overwritten = std::any_of(begin(headings) + i + 1, end(headings), [&](OverlayHeading const& later) {
+            return boost::algorithm::iequals(toUtf8(later.name), toUtf8(headings[i].name));
+        });
+        if (overwritten)
+            continue;
+        auto path = dir / overlayFilePath(headings[i].name);
+        auto image = std::count(begin(unique), end(unique), i) ? 0 : i % 2;
+        ASSERT_EQ(images[image], read_all_bytes(path.string().c_str()));
+    }
+    auto written = read_all_bytes(aliases.string().c_str());
+    ASSERT_EQ(expectedAliases, std::string(begin(written), end(written)));
+    fs::remove_all(dir);
+    fs::remove(aliases);
+
+    auto bad = headings;
+    bad[5].name = u"../escaped.bmp";
+    ASSERT_THROW(writeOverlay(&reader, bad, dir, aliases, true), std::runtime_error);
+    bad[5].name = u"/escaped.bmp";
+    ASSERT_THROW(writeOverlay(&reader, bad, dir, aliases, true), std::runtime_error);
+    ASSERT_FALSE(fs::exists("simple_testdict1/escaped.bmp"));
+    ASSERT_FALSE(fs::exists(aliases));
+    fs::remove_all(dir);
+}
+
+TEST(Tests, overlayZipTest) {
+    namespace fs = boost::filesystem;
+    auto buf = read_all_bytes("simple_testdict1/overlay_x5.lsd");
+    std::vector<std::vector<uint8_t>> images {
+        read_all_bytes("simple_testdict1/image1.bmp"),
+        read_all_bytes("simple_testdict1/image2.bmp")
+    };
+    fs::path zipPath("simple_testdict1/overlay_zip_test.files.zip");
+    fs::path aliases("simple_testdict1/overlay_zip_test.files.aliases");
+    for (bool concurrent : {false, true}) {
+        BitStreamAdapter bstr(new InMemoryStream(&buf[0], buf.size()));
+        LSDDictionary reader(&bstr, concurrent);
+        auto overlay = reader.readOverlayHeadings();
+        ASSERT_EQ(2, overlay.size());
+        auto streamSize = std::max(overlay[0].streamSize, overlay[1].streamSize);
+        overlay[0].streamSize = overlay[1].streamSize = streamSize;
+        // all but every seventh entry repeat one of the first two and go into
+        // the zip with their data; every seventh one has a stream size of its
+        // own, so it isn't a repeat and is deflated anew
+        std::vector<OverlayHeading> headings;
+        std::vector<size_t> expectedImages;
+        std::string expectedAliases;
+        for (unsigned i = 0; i < 41; ++i) {
+            auto heading = overlay[i % 2];
+            auto name = str(boost::format("sub%1%/%2%.bmp") % (i % 3) % i);
+            heading.name = toUtf16(name);
+            if (i % 7 == 4) {
+                heading = overlay[0];
+                heading.name = toUtf16(name);
+                heading.streamSize = streamSize - 1 - i / 7;
+            } else if (i >= 2) {
+                expectedAliases += name + "\t" + toUtf8(headings[i % 2].name) + "\n";
+            }
+            expectedImages.push_back(i % 7 == 4 ? 0 : i % 2);
+            headings.push_back(heading);
+        }
+        fs::remove(zipPath);
+        fs::remove(aliases);
+        writeOverlay(&reader, headings, zipPath, aliases, false);
+
+        unzFile zip = unzOpen64(zipPath.string().c_str());
+        ASSERT_TRUE(zip);
+        size_t i = 0;
+        for (int ret = unzGoToFirstFile(zip); ret == UNZ_OK; ret = unzGoToNextFile(zip), ++i) {
+            ASSERT_LT(i, headings.size());
+            auto& image = images[expectedImages[i]];
+            unz_file_info64 info;
+            char name[64];
+            ASSERT_EQ(UNZ_OK, unzGetCurrentFileInfo64(zip, &info, name, sizeof(name), nullptr, 0, nullptr, 0));
+            ASSERT_EQ(toUtf8(headings[i].name), std::string(name));
+            ASSERT_EQ(crc32(0, image.data(), image.size()), info.crc);
+            ASSERT_EQ(image.size(), info.uncompressed_size);
+            ASSERT_EQ(UNZ_OK, unzOpenCurrentFile(zip));
+            std::vector<uint8_t> data(image.size() + 1);
+            data.resize(unzReadCurrentFile(zip, data.data(), data.size()));
+            // checks the CRC of what was read against the stored one
+            ASSERT_EQ(UNZ_OK, unzCloseCurrentFile(zip));
+            ASSERT_EQ(image, data);
+        }
+        unzClose(zip);
+        ASSERT_EQ(headings.size(), i);
+        auto written = read_all_bytes(aliases.string().c_str());
+        ASSERT_EQ(expectedAliases, std::string(begin(written), end(written)));
+    }
+    fs::remove(zipPath);
+    fs::remove(aliases);
+}
+
+// records the ranges hinted to the stream
+class PrefetchRecordingStream : public InMemoryStream {
+public:
+    std::vector<std::pair<uint64_t, unsigned>> hints;
+    PrefetchRecordingStream(const void* buf, unsigned size) : InMemoryStream(buf, size) { }
+    virtual bool prefetch(uint64_t pos, unsigned byteCount) override {
+        hints.push_back({pos, byteCount});
+        return true;
+    }
+};
+
+TEST(Tests, articlePrefetcherTest) {
+    for (auto path : {"simple_testdict1/headingsTestDict1_x5.lsd",
+                      "simple_testdict1/variants_testdict.lsd"}) {
+        for (bool dumb : {false, true}) {
+            auto buf = read_all_bytes(path);
+            PrefetchRecordingStream ras(&buf[0], buf.size());
+            BitStreamAdapter bstr(&ras);
+            LSDDictionary reader(&bstr);
+            auto headings = reader.readHeadings();
+            if (!dumb) {
+                collapseVariants(headings);
+            }
+            std::vector<unsigned> order;
+            foreachReferenceSet(headings, [&](auto first, auto) {
+                order.push_back(first->articleReference());
+            }, dumb);
+            auto sorted = order;
+            std::sort(begin(sorted), end(sorted));
+            sorted.erase(std::unique(begin(sorted), end(sorted)), end(sorted));
+            const size_t window = 2;
+            ASSERT_LT(window, order.size());
+            auto articlesOffset = reader.header().articlesOffset;
+            ras.hints.clear();
+            ArticlePrefetcher prefetcher(&reader, headings, dumb, window);
+            size_t hinted = 0;
+            bool lastHinted = false;
+            for (size_t current = 0; current < order.size(); ++current) {
+                prefetcher.advance(current);
+                for (; hinted < ras.hints.size(); ++hinted) {
+                    ASSERT_LT(hinted, current + window) << path;
+                    // an article runs up to the next larger reference
+                    unsigned reference = order.at(hinted);
+                    auto next = std::upper_bound(begin(sorted), end(sorted), reference);
+                    unsigned end = next == sorted.end() ? reader.articlesSize() : *next;
+                    ASSERT_EQ(articlesOffset + reference, ras.hints[hinted].first) << path;
+                    ASSERT_EQ(end - reference, ras.hints[hinted].second) << path;
+                    lastHinted |= end == reader.articlesSize();
+                }
+                ASSERT_EQ(std::min(order.size(), current + window), hinted) << path;
+            }
+            ASSERT_TRUE(lastHinted) << path;
+        }
+    }
+}
+
+TEST(Tests, writeDslTest) {
+    namespace fs = boost::filesystem;
+    fs::path dir("simple_testdict1/write_dsl_test");
+    for (auto name : {"test.lsd", "overlay_x5.lsd", "variants_testdict.lsd"}) {
+        auto buf = read_all_bytes((fs::path("simple_testdict1") / name).string().c_str());
+        // converts with a plain or a concurrent reader, returning the dsl or
+        // the dictzip file as it is
+        auto convert = [&](bool concurrent, DslWriterOptions const& options) {
+            fs::remove_all(dir);
+            fs::create_directories(dir);
+            InMemoryStream ras(&buf[0], buf.size());
+            BitStreamAdapter bstr(&ras);
+            LSDDictionary reader(&bstr, concurrent);
+            int last = 0;
+            writeDSL(&reader, name, dir.string(), options, [&](int percent, std::string) {
+                EXPECT_LE(last, percent);
+                last = percent;
+            });
+            auto dslPath = (dir / fs::path(name).replace_extension("dsl")).string();
+            auto res = read_all_bytes((options.dictzip ? dslPath + ".dz" : dslPath).c_str());
+            EXPECT_FALSE(fs::exists(dslPath + ".articles"));
+            return res;
+        };
+        auto expected = convert(false, DslWriterOptions());
+        for (bool concurrent : {false, true}) {
+            for (bool offsetOrder : {false, true}) {
+                DslWriterOptions options;
+                options.offsetOrder = offsetOrder;
+                ASSERT_EQ(expected, convert(concurrent, options));
+            }
+            DslWriterOptions dictzip;
+            dictzip.dictzip = true;
+            auto dz = convert(concurrent, dictzip);
+            InflateStream gzip(std::unique_ptr<IRandomAccessStream>(new InMemoryStream(dz.data(), dz.size())),
+                               0, DeflateFormat::Gzip);
+            std::vector<uint8_t> inflated(expected.size() + 1);
+            inflated.resize(gzip.readAt(0, inflated.data(), inflated.size()));
+            ASSERT_EQ(expected, inflated);
+            DslWriterOptions utf8;
+            utf8.encoding = DslEncoding::Utf8;
+            auto text = toUtf8(std::u16string(reinterpret_cast<const char16_t*>(expected.data()), expected.size() / 2));
+            ASSERT_EQ(std::vector<uint8_t>(begin(text), end(text)), convert(concurrent, utf8));
+        }
+    }
+    fs::remove_all(dir);
+}
+
+TEST(Tests, lsaPipelineTest) {
+    TaskScheduler scheduler(3);
+    const size_t count = 100;
+    // every entry has i samples of value i, and every third one is skipped
+    // as if its name repeated later
+    auto decode = [](size_t i, std::vector<short>& samples) {
+        samples.assign(i, static_cast<short>(i));
+        return i % 3 != 0;
+    };
+    std::mutex mutex;
+    std::vector<size_t> decoded;
+    std::vector<std::vector<short>> writes(count);
+    std::vector<unsigned> writeCounts(count);
+    uint64_t written = 0;
+    decodeAndWrite(count, [&](size_t i, std::vector<short>& samples) {
+        decoded.push_back(i);
+        return decode(i, samples);
+    }, [&](size_t i, std::vector<short> const& samples) {
+        std::lock_guard<std::mutex> lock(mutex);
+        writes[i] = samples;
+        ++writeCounts[i];
+    }, [&](uint64_t samples) {
+        written += samples;
+    }, scheduler);
+    ASSERT_EQ(count, decoded.size());
+    for (size_t i = 0; i < count; ++i) {
+        ASSERT_EQ(i, decoded[i]);
+        std::vector<short> expected;
+        bool kept = decode(i, expected);
+        ASSERT_EQ(kept ? 1u : 0u, writeCounts[i]);
+        if (kept) {
+            ASSERT_EQ(expected, writes[i]);
+        }
+    }
+    ASSERT_EQ(count * (count - 1) / 2, written);
+
+    // a decode error comes out of the pipeline
+    std::atomic<bool> writtenPastError(false);
+    auto failAt = [&](size_t failing) {
+        decodeAndWrite(count, [&](size_t i, std::vector<short>& samples) {
+            if (i == failing)
+                throw std::runtime_error("error reading LSA");
+            return decode(i, samples);
+        }, [&](size_t i, std::vector<short> const&) {
+            if (i >= failing)
+                writtenPastError = true;
+        }, [](uint64_t) { }, scheduler);
+    };
+    for (size_t failing : {size_t(0), size_t(5), size_t(57), count - 1}) {
+        ASSERT_THROW(failAt(failing), std::runtime_error);
+    }
+    ASSERT_FALSE(writtenPastError);
+    // and so does a write error, once its batch is waited for
+    ASSERT_THROW(decodeAndWrite(count, decode, [](size_t i, std::vector<short> const&) {
+        if (i == 40)
+            throw std::runtime_error("can't write to file");
+    }, [](uint64_t) { }, scheduler), std::runtime_error);
+}
+
+// encodes mono samples as an Ogg Vorbis stream
+std::vector<uint8_t> encodeVorbis(std::vector<short> const& samples) {
+    vorbis_info info;
+    vorbis_info_init(&info);
+    vorbis_encode_init_vbr(&info, 1, 22050, 0.3f);
+    vorbis_comment comment;
+    vorbis_comment_init(&comment);
+    vorbis_dsp_state dsp;
+    vorbis_analysis_init(&dsp, &info);
+    vorbis_block block;
+    vorbis_block_init(&dsp, &block);
+    ogg_stream_state stream;
+    ogg_stream_init(&stream, 1);
+    std::vector<uint8_t> res;
+    ogg_page page;
+    auto append = [&] {
+        res.insert(end(res), page.header, page.header + page.header_len);
+        res.insert(end(res), page.body, page.body + page.body_len);
+    };
+    ogg_packet header, headerComment, headerCode;
+    vorbis_analysis_headerout(&dsp, &comment, &header, &headerComment, &headerCode);
+    ogg_stream_packetin(&stream, &header);
+    ogg_stream_packetin(&stream, &headerComment);
+    ogg_stream_packetin(&stream, &headerCode);
+    while (ogg_stream_flush(&stream, &page)) {
+        append();
+    }
+    auto encode = [&](size_t pos, size_t count) {
+        if (count) {
+            float** buffer = vorbis_analysis_buffer(&dsp, count);
+            for (size_t i = 0; i < count; ++i) {
+                buffer[0][i] = samples[pos + i] / 32768.f;
+            }
+        }
+        // a count of 0 ends the stream
+        vorbis_analysis_wrote(&dsp, count);
+        while (vorbis_analysis_blockout(&dsp, &block) == 1) {
+            vorbis_analysis(&block, nullptr);
+            vorbis_bitrate_addblock(&block);
+            ogg_packet packet;
+            while (vorbis_bitrate_flushpacket(&dsp, &packet)) {
+                ogg_stream_packetin(&stream, &packet);
+                while (ogg_stream_pageout(&stream, &page)) {
+                    append();
+                }
+            }
+        }
+    };
+    for (size_t pos = 0; pos < samples.size(); pos += 1024) {
+        encode(pos, std::min<size_t>(1024, samples.size() - pos));
+    }
+    encode(0, 0);
+    while (ogg_stream_flush(&stream, &page)) {
+        append();
+    }
+    ogg_stream_clear(&stream);
+    vorbis_block_clear(&block);
+    vorbis_dsp_clear(&dsp);
+    vorbis_comment_clear(&comment);
+    vorbis_info_clear(&info);
+    return res;
+}
+
+// an LSA archive of tones, one entry of the given sample count per name
+std::vector<uint8_t> makeLSA(std::vector<std::string> const& names,
+                             std::vector<unsigned> const& sizes,
+                             double frequency)
+{
+    std::vector<uint8_t> res;
+    auto putString = [&](std::string const& str) {
+        for (char ch : str) {
+            res.push_back(ch);
+            res.push_back(0);
+        }
+        res.push_back(0xFF);
+    };
+    auto put32 = [&](uint32_t value) {
+        for (int i = 0; i < 4; ++i) {
+            res.push_back(value >> (8 * i));
+        }
+    };
+    putString("L9SA");
+    put32(names.size());
+    std::vector<short> samples;
+    for (size_t i = 0; i < names.size(); ++i) {
+        putString(names[i]);
+        if (i > 0) {
+            put32(samples.size());
+            res.push_back(0xFF);
+        }
+        put32(sizes[i]);
+        for (unsigned j = 0; j < sizes[i]; ++j) {
+            samples.push_back(10000 * sin(frequency * (i + 1) * j / 22050));
+        }
+    }
+    auto ogg = encodeVorbis(samples);
+    res.insert(end(res), begin(ogg), end(ogg));
+    return res;
+}
+
+TEST(Tests, concurrentLsaTest) {
+    namespace fs = boost::filesystem;
+    std::vector<std::string> names {"a.wav", "b.wav", "c.wav"};
+    std::vector<std::vector<uint8_t>> archives {
+        makeLSA(names, {30000, 7000, 50000}, 2 * M_PI * 440),
+        makeLSA(names, {45000, 20000, 11000}, 2 * M_PI * 300)
+    };
+    auto dump = [&](size_t k, fs::path dir) {
+        fs::remove_all(dir);
+        fs::create_directories(dir);
+        InMemoryStream stream(archives[k].data(), archives[k].size());
+        LSAReader reader(&stream);
+        reader.collectHeadings();
+        reader.dump(dir.string(), 0, [](int) { });
+    };
+    fs::path root("simple_testdict1/lsa_test");
+    for (size_t k = 0; k < archives.size(); ++k) {
+        dump(k, root / str(boost::format("serial%1%") % k));
+    }
+    // both archives decoded at once must come out as they do one by one
+    TaskScheduler scheduler(2);
+    TaskGroup group(scheduler);
+    for (size_t k = 0; k < archives.size(); ++k) {
+        group.run([&, k] { dump(k, root / str(boost::format("concurrent%1%") % k)); });
+    }
+    group.wait();
+    for (size_t k = 0; k < archives.size(); ++k) {
+        for (auto& name : names) {
+            auto serial = root / str(boost::format("serial%1%") % k) / name;
+            auto concurrent = root / str(boost::format("concurrent%1%") % k) / name;
+            ASSERT_EQ(read_all_bytes(serial.string().c_str()),
+                      read_all_bytes(concurrent.string().c_str()));
+        }
+    }
+    fs::remove_all(root);
+}